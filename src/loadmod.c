@@ -11,33 +11,80 @@
 #include <string.h>
 #include "loadmod.h"
 #include "mod.h"
+#include "mpthread.h"
 #include <stdio.h>    /* get rid of this one later */
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #ifdef PLAT_LINUX
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#else
+#include <windows.h>
 #endif
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define ISDIGIT(c) (((c) >= '0') && ((c) <= '9'))
+#define PREPALIGN(p) \
+  ((uint8*) (((size_t) (p) + MOD_PREP_ALIGN - 1) & ~(size_t) (MOD_PREP_ALIGN - 1)))
 
 /* Local prototypes                                                          */
 static void LowerString(char* st);
-static MPstatus LoadModPattern(FILE* fd, int pat_no, int num_channels);
-static MPstatus LoadModSampleDescription(FILE* fd, int sample_no);
-static MPstatus LoadModTitle(FILE* fd);
-static MPstatus LoadModAllSampleDescriptions(FILE* fd);
-static MPstatus LoadModLength(FILE* fd);
-static MPstatus LoadModIgnore(FILE* fd);
-static MPstatus LoadModPatternTable(FILE* fd);
-static MPstatus LoadModDescription(FILE* fd);
-static MPstatus SetModHighestPattern(void);
-static MPstatus SetModNumberChannels(void);
-static MPstatus LoadModAllPatterns(FILE* fd);
-static MPstatus LoadModSample(FILE* fd, int8* mem_ptr, uint32 samp_size);
-static MPstatus LoadModAllSamples(FILE* fd);
-
-/* Mod definition.  This struct will be declared extern in other files.      */
-/* This should be the only global variable (the speed is necessary)          */
-struct mod_data mod;
+static void DecodeModSampleDescription(struct mod_data* mod, const uint8* buf,
+                                       int sample_no);
+static void DecodeModPattern(uint32* cells, const uint8* buf,
+                             int num_channels);
+static MPstatus SetModHighestPattern(struct mod_data* mod);
+static MPstatus SetModNumberChannels(struct mod_data* mod);
+static MPstatus SetModPatternSlots(struct mod_data* mod);
+static MPstatus DecodeModHeader(struct mod_data* mod, const uint8* buf);
+static uint32 ModImageSize(const struct mod_data* mod);
+static void SetModInfo(struct mod_info* info, const struct mod_data* mod,
+                       uint32 file_size);
+static MPstatus ModFileSize(FILE* fd, uint32* ret_size);
+static MPstatus CompileModRows(struct mod_data* mod);
+static MPstatus ReadModFile(FILE* fd, uint8** ret_data, uint32* ret_size);
+static MPstatus DecodeModPatterns(struct mod_data* mod, const uint8* buf);
+static MPstatus LoadModFromMemory(struct mod_data* mod, const uint8* data,
+                                  uint32 size);
+static MPstatus NewModule(MPmodule** ret_module);
+static void PrepareSample(struct mod_prep_sample* prep, int format,
+                          void* dst, const int8* src);
+
+
+/* The handle behind MPmodule.  data is first so that a module can be      */
+/* handed around as its mod_data.  The image fields say what file image    */
+/* the module owns (the samples live in it) and must give back in ModFree. */
+struct mod_handle
+{
+  struct mod_data data;
+  long refs;                       /* ModShare/ModFree reference count      */
+  const uint8* image;              /* owned file image, or NULL if borrowed */
+  uint32 image_size;
+  uint8 image_mapped;              /* 1: from MapSong, 0: malloced          */
+
+  /* ModLoadLazy only: samples are read from lazy_fd by ModGetSample the   */
+  /* first time they are asked for, under lazy_lock                        */
+  FILE* lazy_fd;
+  MPmutex lazy_lock;
+  uint32 sample_offset[MOD_NUM_SAMPLES];
+
+  /* ModPrepareSamples: all the samples of one format share one block.     */
+  /* Each format is made once, under prep_lock, and prep_done[format] is   */
+  /* only set (atomically) once all of its copies are filled in            */
+  MPmutex prep_lock;
+  long prep_done[MOD_PREP_FORMATS];
+  void* prep_block[MOD_PREP_FORMATS];
+  uint32 prep_size[MOD_PREP_FORMATS];
+  struct mod_prep_sample prep[MOD_PREP_FORMATS][MOD_NUM_SAMPLES];
+};
+
+/* The reference count may be touched by several player threads at once,  */
+/* hence ATOMICINC/ATOMICDEC (mpthread.h)                                  */
+
 
 
 /* Converts a string to all lower case.  Presumes ASCII or other             */
@@ -87,318 +134,1074 @@ MPstatus OpenSong(const char* songname, FILE** fd)
 
 
 
-/* Modifies global "mod" variable                                            */
-/* Reads the MOD file's title.  The file position is assumed to be correct.  */
-/* i.e. the order in which the LoadMod.... functions are called is important */
-MPstatus LoadModTitle(FILE* mod_fd)
+/* buf holds one MOD_SAMPLE_DESC_SIZE byte sample description as it appears */
+/* in the file.  A loop that runs past the end of the sample (common in the */
+/* wild) is cut short at the end, and one that starts past it is dropped,   */
+/* so that no player reads beyond the sample's data.                        */
+void DecodeModSampleDescription(struct mod_data* mod, const uint8* buf,
+                                int samp_number)
 {
-  if (fread(mod.title, 1, MOD_TITLE_NAME_SIZE, mod_fd) != MOD_TITLE_NAME_SIZE)
-    return(MP_BADFILE);
-  return(MP_OK);
-}
-
-
-
-/* Modifies global "mod" variable                                            */
-MPstatus LoadModSampleDescription(FILE* mod_fd, int samp_number)
-{
-  uint8 buf[2];
+  struct mod_samp_desc* desc;
   uint16 word;
 
-  if (fread(mod.sample_desc[samp_number].name, 1, MOD_SAMPLE_NAME_SIZE, mod_fd) != MOD_SAMPLE_NAME_SIZE)
-    return(MP_BADFILE);
+  memcpy(mod->sample_desc[samp_number].name, buf, MOD_SAMPLE_NAME_SIZE);
+  buf += MOD_SAMPLE_NAME_SIZE;
 
   /* NOTE: we can't directly read to a word variable because of the          */
   /* endian-ness problem                                                     */
-  if (fread(buf, 1, 2, mod_fd) != 2)
-    return(MP_BADFILE);
- 
   word = (((uint16) buf[0]) << 8) + (uint16) buf[1];
 
   /* Convert from length in words to length in bytes                         */
-  mod.sample_desc[samp_number].length = ((uint32) word) << 1;
+  mod->sample_desc[samp_number].length = ((uint32) word) << 1;
 
-  if (fread(&mod.sample_desc[samp_number].finetune, 1, 1, mod_fd) != 1)
-    return(MP_BADFILE);
   /* Only LS nibble used.  This clears the upper 4 bits just in case.        */
-  mod.sample_desc[samp_number].finetune &= 0x0F;
+  mod->sample_desc[samp_number].finetune = buf[2] & 0x0F;
+  mod->sample_desc[samp_number].volume = buf[3];
 
-  if (fread(&mod.sample_desc[samp_number].volume, 1, 1, mod_fd) != 1)
-    return(MP_BADFILE);
+  word = (((uint16) buf[4]) << 8) + (uint16) buf[5];
+  mod->sample_desc[samp_number].repeat_point = ((uint32) word) << 1;
 
-  if (fread(buf, 1, 2, mod_fd) != 2)
-    return(MP_BADFILE);
-  word = (((uint16) buf[0]) << 8) + (uint16) buf[1];
-  mod.sample_desc[samp_number].repeat_point = ((uint32) word) << 1;
+  word = (((uint16) buf[6]) << 8) + (uint16) buf[7];
+  mod->sample_desc[samp_number].repeat_length = ((uint32) word) << 1;
 
+  desc = &mod->sample_desc[samp_number];
+  if (desc->repeat_length > 2)
+  {
+    if (desc->repeat_point >= desc->length)
+      desc->repeat_point = desc->repeat_length = 0;
+    else if (desc->repeat_point + desc->repeat_length > desc->length)
+      desc->repeat_length = desc->length - desc->repeat_point;
+  }
+}
 
-  if (fread(buf, 1, 2, mod_fd) != 2)
-    return(MP_BADFILE);
-  word = (((uint16) buf[0]) << 8) + (uint16) buf[1];
-  mod.sample_desc[samp_number].repeat_length = ((uint32) word) << 1;
 
-  return(MP_OK);
+
+/* buf holds a whole pattern as it appears in the file.  i.e.              */
+/* MOD_NUM_DIVISIONS * num_channels cells of MOD_CELL_SIZE bytes each.      */
+/* They are packed into cells (see mod.h) in the same order.                */
+/* With SSE2, four cells are done at once.  Loaded little-endian, the file  */
+/* cell b0 b1 b2 b3 is the word v = b3:b2:b1:b0 and the packed cell is just */
+/* shifts and masks of v:                                                   */
+/*   sample hi nibble  (v << 24) & 0xF0000000                               */
+/*   period hi nibble  (v << 20) & 0x00F00000                               */
+/*   sample lo nibble, period lo byte  (v << 4) & 0x0F0FF000                */
+/*   effect            (v >> 8)  & 0x00000F00                               */
+/*   arguments          v >> 24                                             */
+void DecodeModPattern(uint32* cells, const uint8* buf, int num_channels)
+{
+  const uint8* cdata = buf;
+  int n = 0, num_cells = MOD_NUM_DIVISIONS * num_channels;
+#ifdef HAVE_SSE2
+  __m128i v;
+  const __m128i mask_sh = _mm_set1_epi32((int) 0xF0000000);
+  const __m128i mask_ph = _mm_set1_epi32(0x00F00000);
+  const __m128i mask_lo = _mm_set1_epi32(0x0F0FF000);
+  const __m128i mask_ef = _mm_set1_epi32(0x00000F00);
+
+  for(; n + 4 <= num_cells; n += 4)
+  {
+    v = _mm_loadu_si128((const __m128i*) cdata);
+    _mm_storeu_si128((__m128i*) (cells + n),
+      _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 24), mask_sh),
+                     _mm_and_si128(_mm_slli_epi32(v, 20), mask_ph)),
+        _mm_or_si128(
+          _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 4), mask_lo),
+                       _mm_and_si128(_mm_srli_epi32(v, 8), mask_ef)),
+          _mm_srli_epi32(v, 24))));
+    cdata += 4 * MOD_CELL_SIZE;
+  }
+#endif
+
+  /* Whatever is left (everything, without SSE2)                       */
+  for(; n < num_cells; n++)
+  {
+    /* Sample number is split: high nibble in byte 0, low nibble in    */
+    /* byte 2.  The period is the low nibble of byte 0 and byte 1 (it  */
+    /* is big-endian, Amiga style), and the effect and its arguments   */
+    /* are the low nibble of byte 2 and byte 3.                        */
+    /* Note: We are guaranteed logical shift with unsigned quantities */
+    cells[n] = (((uint32) ((cdata[0] & 0xF0) | (cdata[2] >> 4))) << 24) |
+               (((uint32) (cdata[0] & 0x0F)) << 20) |
+               (((uint32) cdata[1]) << 12) |
+               (((uint32) (cdata[2] & 0x0F)) << 8) |
+               ((uint32) cdata[3]);
+    cdata += MOD_CELL_SIZE;
+  }
 }
 
 
 
-MPstatus LoadModAllSampleDescriptions(FILE* mod_fd)
+/* Sets mod->highest_pattern to the highest pattern found in the pattern */
+/* table.  Requires that both the                                       */
+/* pattern table AND the description have been loaded (as we can check  */
+/* if the number of patterns is allowed to go over 63                   */ 
+MPstatus SetModHighestPattern(struct mod_data* mod)
 {
   int n;
-  MPstatus status;
-  for (n=0; n < MOD_NUM_SAMPLES; n++)
-    if ((status = LoadModSampleDescription(mod_fd, n)) != MP_OK)
-      return(status); 
+  uint8 big = 0, curr;
+  for(n=0; n<MOD_PATTERN_TABLE_SIZE; n++)
+    big = ((curr = mod->pattern_table[n]) > big) ? curr : big;
+  if (big >= MOD_MAX_PATTERNS)
+    return(MP_BADTABLE);
+
+  /* if there is reference to patterns above 63 and we are an old 4 or  */
+  /* 8 channel mod (not M!K! protracker, not one of the later           */
+  /* multichannel formats) then there's trouble                         */
+  if ((big >= MOD_PATTERNS) && (!strcmp("M.K.", mod->description) ||
+                                !strcmp("FLT4", mod->description) ||
+                                !strcmp("FLT8", mod->description)))
+    return(MP_BADTABLE);
+
+  /* set the number of patterns in the mod structure                    */
+  mod->highest_pattern = big;
   return(MP_OK);
 }
 
 
-  
-MPstatus LoadModLength(FILE* mod_fd)
+
+/* Sets the number of channels by looking at the description (which     */
+/* must have been previously loaded).  Besides the fixed descriptions   */
+/* there are the multichannel ones: xCHN (1..9 channels), xxCH (10..32) */
+/* and TDZx (1..9).                                                      */
+MPstatus SetModNumberChannels(struct mod_data* mod)
 {
-  if (fread(&mod.length, 1, 1, mod_fd) != 1)
-    return(MP_BADFILE);
+  char* descriptions[] = { "M.K.", "M!K!", "FLT4", 
+                           "FLT8", "CD81", "OCTA" };
+  int channels[] = { 4, 4, 4, 8, 8, 8 };
+  const char* d = mod->description;
+  int n, num = 0;
+
+  for (n=0; n<6; n++)
+    if (!strcmp(descriptions[n],mod->description))
+    {
+      mod->number_channels = channels[n];
+      return(MP_OK);
+    }
+
+  if (ISDIGIT(d[0]) && !strcmp(d + 1, "CHN"))
+    num = d[0] - '0';
+  else if (ISDIGIT(d[0]) && ISDIGIT(d[1]) && !strcmp(d + 2, "CH"))
+    num = (d[0] - '0') * 10 + d[1] - '0';
+  else if (!strncmp(d, "TDZ", 3) && ISDIGIT(d[3]))
+    num = d[3] - '0';
+
+  if ((num < 1) || (num > MOD_MAX_CHANNELS))
+    return(MP_BADDESC);
+  mod->number_channels = num;
   return(MP_OK);
 }
 
 
 
-MPstatus LoadModIgnore(FILE* mod_fd)
+/* Works out which patterns the song can actually reach (the ones in the */
+/* first mod->length entries of the pattern table) and gives each one a */
+/* slot in the packed pattern storage.  The rest are dropped.  Requires */
+/* SetModHighestPattern to have been called.                            */
+MPstatus SetModPatternSlots(struct mod_data* mod)
 {
-  if (fread(&mod.ignore, 1, 1, mod_fd) != 1)
-    return(MP_BADFILE);
+  int n;
+
+  if (mod->length > MOD_PATTERN_TABLE_SIZE)
+    return(MP_BADTABLE);
+
+  memset(mod->pattern_slot, MOD_NO_SLOT, MOD_MAX_PATTERNS);
+  for (n = 0; n < mod->length; n++)
+    mod->pattern_slot[mod->pattern_table[n]] = 0;
+
+  mod->number_patterns = 0;
+  for (n = 0; n <= mod->highest_pattern; n++)
+    if (mod->pattern_slot[n] != MOD_NO_SLOT)
+      mod->pattern_slot[n] = mod->number_patterns++;
+  return(MP_OK);
+}
+
+
+
+/* buf holds the MOD_HEADER_SIZE bytes at the start of a mod file.  All   */
+/* of the mod structure that comes from them is filled in: the title,   */
+/* sample descriptions, pattern table and description, and from those   */
+/* the number of channels and the pattern slots.  Nothing is malloced,  */
+/* so this is all ModProbe needs.                                       */
+MPstatus DecodeModHeader(struct mod_data* mod, const uint8* buf)
+{
+  const uint8* p = buf;
+  MPstatus status;
+  int n;
+
+  memcpy(mod->title, p, MOD_TITLE_NAME_SIZE);
+  p += MOD_TITLE_NAME_SIZE;
+
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
+  {
+    DecodeModSampleDescription(mod, p, n);
+    p += MOD_SAMPLE_DESC_SIZE;
+  }
+
+  mod->length = *p++;
+  mod->ignore = *p++;
+  memcpy(mod->pattern_table, p, MOD_PATTERN_TABLE_SIZE);
+  p += MOD_PATTERN_TABLE_SIZE;
+  memcpy(mod->description, p, MOD_DESC_SIZE);
+  mod->description[MOD_DESC_SIZE] = '\0';
+
+  if ((status = SetModHighestPattern(mod) | SetModNumberChannels(mod)) != MP_OK)
+    return(status);
+  return(SetModPatternSlots(mod));
+}
+
+
+
+/* The number of bytes a whole file must have for the header decoded     */
+/* into mod: the header, every pattern up to the highest one, and the    */
+/* samples.                                                              */
+uint32 ModImageSize(const struct mod_data* mod)
+{
+  uint32 size;
+  int n;
+
+  size = MOD_HEADER_SIZE + (mod->highest_pattern + 1) * MOD_NUM_DIVISIONS *
+         mod->number_channels * MOD_CELL_SIZE;
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
+    size += mod->sample_desc[n].length;
+  return(size);
+}
+
+
+
+/* Turns the packed patterns into the player's event stream (see mod.h) */
+/* Empty cells produce no event.  Flow effects are looked at here once  */
+/* and summed up in the row so the player only has to read the flags.   */
+/* If a row has more than one of the same flow effect the last one wins */
+/* Requires that all the patterns were loaded previously                */
+MPstatus CompileModRows(struct mod_data* mod)
+{
+  uint32 cells, cell, n, r, e = 0;
+  struct mod_row* row;
+  struct mod_event* ev;
+  int c;
+
+  cells = mod->number_patterns * MOD_NUM_DIVISIONS * mod->number_channels;
+  mod->number_events = 0;
+  if (!cells)
+    return(MP_OK);
+  if (!mod->pattern)
+    return(MP_NOMEM);
+  for (n = 0; n < cells; n++)
+    if (mod->pattern[n])
+      mod->number_events++;
+
+  if (!(mod->row = (struct mod_row*) calloc(mod->number_patterns *
+                                            MOD_NUM_DIVISIONS,
+                                            sizeof(struct mod_row))))
+    return(MP_NOMEM);
+  if (mod->number_events &&
+      !(mod->event = (struct mod_event*) malloc(mod->number_events *
+                                                sizeof(struct mod_event))))
+    return(MP_NOMEM);
+
+  /* The cells of row r are pattern[r * number_channels ...] since the  */
+  /* slots and their divisions are stored one after the other           */
+  for (r = 0; r < mod->number_patterns * MOD_NUM_DIVISIONS; r++)
+  {
+    row = &mod->row[r];
+    row->first_event = e;
+    for (c = 0; c < mod->number_channels; c++)
+    {
+      if (!(cell = mod->pattern[r * mod->number_channels + c]))
+        continue;
+      ev = &mod->event[e++];
+      row->number_events++;
+      ev->channel = (uint8) c;
+      /* The cell has room for 255 samples but a MOD only has 31; a     */
+      /* bigger number is junk and is played as no sample at all        */
+      ev->sample_number = MODCELLSAMPLE(cell);
+      if (ev->sample_number > MOD_NUM_SAMPLES)
+        ev->sample_number = 0;
+      ev->period = MODCELLPERIOD(cell);
+      ev->effect = MODCELLEFFECT(cell);
+      ev->argx = MODCELLARGX(cell);
+      ev->argy = MODCELLARGY(cell);
+      ev->arg = (ev->argx << 4) + ev->argy;
+
+      switch (ev->effect)
+      {
+      case 0xB:  /* Position Jump */
+        if (ev->arg < mod->length)
+        {
+          row->flags |= MOD_ROW_JUMP;
+          row->jump_pos = ev->arg;
+        }
+        else
+          row->flags |= MOD_ROW_BADJUMP;
+        break;
+
+      case 0xD:  /* Pattern Break.  The argument is decimal!             */
+        if ((ev->argx * 10) + ev->argy < MOD_NUM_DIVISIONS)
+        {
+          row->flags |= MOD_ROW_BREAK;
+          row->break_row = (ev->argx * 10) + ev->argy;
+        }
+        else
+          row->flags |= MOD_ROW_BADJUMP;
+        break;
+
+      case 0xF:  /* Set Speed                                             */
+        /* a different MOD spec says <= 32.  Make a command line flag     */
+        /* choose.  Treat 0 as 1.  Make a cl flag if we want this too.    */
+        if (ev->arg < 32)
+        {
+          row->flags |= MOD_ROW_SPEED;
+          row->speed = ev->arg ? ev->arg : 1;
+        }
+        else
+        {
+          row->flags |= MOD_ROW_TEMPO;
+          row->tempo = ev->arg;
+        }
+        break;
+
+      case 0xE:  /* Pattern Loop and Pattern Delay                        */
+        if (ev->argx == 0x6)
+        {
+          row->flags |= MOD_ROW_LOOP;
+          row->loop = ev->argy;
+        }
+        else if (ev->argx == 0xE)
+        {
+          row->flags |= MOD_ROW_DELAY;
+          row->delay = ev->argy;
+        }
+        break;
+      }
+    }
+  }
   return(MP_OK);
 }
 
 
 
-MPstatus LoadModPatternTable(FILE* mod_fd)
+/* buf holds every pattern up to mod->highest_pattern as they are in the  */
+/* file.  The reachable ones are packed into the malloced pattern array   */
+/* and compiled into rows.  Requires DecodeModHeader.                     */
+MPstatus DecodeModPatterns(struct mod_data* mod, const uint8* buf)
 {
-  int numread;
-  numread = fread(mod.pattern_table, 1, MOD_PATTERN_TABLE_SIZE, mod_fd);
-  if (numread != MOD_PATTERN_TABLE_SIZE)
+  int n;
+
+  if (mod->number_patterns &&
+      !(mod->pattern = (uint32*) malloc(mod->number_patterns *
+                                        MOD_NUM_DIVISIONS *
+                                        mod->number_channels *
+                                        sizeof(uint32))))
+    return(MP_NOMEM);
+
+  for (n = 0; n <= mod->highest_pattern; n++)
+  {
+    if (mod->pattern_slot[n] != MOD_NO_SLOT)
+      DecodeModPattern(&MODCELL(mod, mod->pattern_slot[n], 0, 0), buf,
+                       mod->number_channels);
+    buf += MOD_NUM_DIVISIONS * mod->number_channels * MOD_CELL_SIZE;
+  }
+  return(CompileModRows(mod));
+}
+
+
+
+/* Finds the number of bytes from the current position of mod_fd to the  */
+/* end of the file.  The position is left where it was.                  */
+MPstatus ModFileSize(FILE* mod_fd, uint32* ret_size)
+{
+  long start, end;
+
+  if (((start = ftell(mod_fd)) < 0) || fseek(mod_fd, 0, SEEK_END) ||
+      ((end = ftell(mod_fd)) < start) || fseek(mod_fd, start, SEEK_SET))
     return(MP_BADFILE);
+  *ret_size = (uint32) (end - start);
   return(MP_OK);
 }
 
 
 
-MPstatus LoadModDescription(FILE* mod_fd)
+/* Reads everything from the current position of mod_fd to the end of the */
+/* file into one malloced buffer, with a single fread.  The file must be  */
+/* seekable so that the size is known up front.                           */
+MPstatus ReadModFile(FILE* mod_fd, uint8** ret_data, uint32* ret_size)
 {
-  if (fread(mod.description, 1, MOD_DESC_SIZE, mod_fd) != MOD_DESC_SIZE)
+  MPstatus status;
+
+  if ((status = ModFileSize(mod_fd, ret_size)) != MP_OK)
+    return(status);
+  if (!(*ret_data = (uint8*) malloc(*ret_size ? *ret_size : 1)))
+    return(MP_NOMEM);
+  if (fread(*ret_data, 1, *ret_size, mod_fd) != *ret_size)
+  {
+    free(*ret_data);
     return(MP_BADFILE);
-  mod.description[MOD_DESC_SIZE] = '\0';
+  }
   return(MP_OK);
-} 
+}
 
 
 
-MPstatus LoadModPattern(FILE* mod_fd, int pat_no, int num_channels)
+/* Builds the mod structure directly over a memory image of a mod file.    */
+/* Nothing is copied except the header fields and the patterns: the sample */
+/* pointers point straight into data.  The memory must stay valid (and     */
+/* unchanged) for as long as the mod is being played.  data may come from  */
+/* MapSong or from anywhere else the caller likes.                         */
+MPstatus LoadModFromMemory(struct mod_data* mod, const uint8* data,
+                           uint32 size)
 {
-  uint8 cdata[4];
-  int channel, division;
-  uint16 temp_word = 0;
+  const uint8* p = data + MOD_HEADER_SIZE;
+  const uint8* end = data + size;
+  uint32 pattern_size;
+  MPstatus status;
+  int n;
 
-  for(division = 0; division < MOD_NUM_DIVISIONS; division++)
-    for(channel = 0; channel < num_channels; channel++)
+  if (size < MOD_HEADER_SIZE)
+    return(MP_BADFILE);
+  if ((status = DecodeModHeader(mod, data)) != MP_OK)
+    return(status);
+
+  pattern_size = (mod->highest_pattern + 1) * MOD_NUM_DIVISIONS *
+                 mod->number_channels * MOD_CELL_SIZE;
+  if ((uint32) (end - p) < pattern_size)
+    return(MP_BADFILE);
+  if ((status = DecodeModPatterns(mod, p)) != MP_OK)
+    return(status);
+  p += pattern_size;
+
+  /* NULL means no sample                                               */
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
+  {
+    mod->sample[n] = NULL;
+    if (mod->sample_desc[n].length > 0)
     {
-      if (fread(cdata, 1, 4, mod_fd) != 4)
-        return(MP_BADFILE);
-
-      /* Note: We are guaranteed logical shift with unsigned quantities */
-      mod.pattern[pat_no][division][channel].sample_number = 
-        (cdata[0] & 0xF0) + (cdata[2] >> 4);
-
-      /* Remember what is going on!  The PC is little-endian while the  */
-      /* Amiga is big-endian.  The cast sticks the LSB in the first     */
-      /* byte of the word.  The shift will relocate it to the second.   */
-      /* Note that the casts are not strictly necessary since doing a   */
-      /* logical shift automatically performs an integral promotion.    */
-      temp_word = ((uint16) (cdata[0] & 0x0F)) << 8;  
-      mod.pattern[pat_no][division][channel].period = 
-        temp_word + ((uint16) cdata[1]);
-
-      temp_word = ((uint16) (cdata[2] & 0x0F)) << 8;
-      temp_word += ((uint16) cdata[3]);
-
-      mod.pattern[pat_no][division][channel].effect = (uint8) (temp_word >> 8);
-      mod.pattern[pat_no][division][channel].argx = (uint8) ((temp_word & 0x00F0) >> 4);
-      mod.pattern[pat_no][division][channel].argy = (uint8) (temp_word & 0x000F);
-      /* Note: The ANSI standard guaranteed left bits will be ignored   */
-      /* during the integer conversions.  This could probably be done   */
-      /* faster... but this stuff isn't timing critical.                */
- 
-    };
+      if ((uint32) (end - p) < mod->sample_desc[n].length)
+        return(MP_UNEXPECTED_EOF);
+      mod->sample[n] = (const int8*) p;
+      p += mod->sample_desc[n].length;
+    }
+  }
   return(MP_OK);
 }
 
 
 
-/* Sets mod.highest_pattern to the highest pattern found in the pattern */
-/* table.  Requires that both the                                       */
-/* pattern table AND the description have been loaded (as we can check  */
-/* if the number of patterns is allowed to go over 63                   */ 
-MPstatus SetModHighestPattern(void)
+/* Maps the whole of a song file read-only into memory.  Meant to be used  */
+/* with LoadModFromMemory.  Pages are only read in as the player touches   */
+/* them.  Undo with UnmapSong.                                             */
+MPstatus MapSong(const char* songname, const uint8** data, uint32* size)
 {
-  int n;
-  uint8 big = 0, curr;
-  for(n=0; n<MOD_PATTERN_TABLE_SIZE; n++)
-    big = ((curr = mod.pattern_table[n]) > big) ? curr : big;
-  if (big >= MOD_MAX_PATTERNS)
-    return(MP_BADTABLE);
+#ifdef PLAT_LINUX
+  struct stat st;
+  void* addr;
+  int fd;
 
-  /* if there is reference to patterns above 63 and we are not a        */
-  /* protracker mod then there's trouble                                */
-  if ((big >= MOD_PATTERNS) && (strcmp("M!K!", mod.description)))
-    return(MP_BADTABLE);
+  if ((fd = open(songname, O_RDONLY, 0)) == -1)
+    return(MP_BADFILE);
+  if ((fstat(fd, &st) == -1) || (st.st_size <= 0))
+  {
+    close(fd);
+    return(MP_BADFILE);
+  }
+  addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);                /* the mapping keeps its own reference      */
+  if (addr == MAP_FAILED)
+    return(MP_NOMEM);
 
-  /* set the number of patterns in the mod structure                    */
-  mod.highest_pattern = big;
+  *data = (const uint8*) addr;
+  *size = (uint32) st.st_size;
   return(MP_OK);
+#else
+  HANDLE file, mapping;
+  LARGE_INTEGER file_size;
+  void* addr;
+
+  file = CreateFileA(songname, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return(MP_BADFILE);
+  if (!GetFileSizeEx(file, &file_size) || (file_size.QuadPart <= 0))
+  {
+    CloseHandle(file);
+    return(MP_BADFILE);
+  }
+  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL)
+    return(MP_NOMEM);
+  addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);     /* the view keeps its own reference         */
+  if (addr == NULL)
+    return(MP_NOMEM);
+
+  *data = (const uint8*) addr;
+  *size = (uint32) file_size.QuadPart;
+  return(MP_OK);
+#endif
 }
 
 
 
-/* Sets the number of channels by looking at the description (which     */
-/* must have been previously loaded)                                    */
-MPstatus SetModNumberChannels(void)
+void UnmapSong(const uint8* data, uint32 size)
 {
-  char* descriptions[] = { "M.K.", "M!K!", "FLT4", 
-                           "FLT8", "6CHN", "8CHN" };
-  int n, desc = -1;
+#ifdef PLAT_LINUX
+  munmap((void*) data, size);
+#else
+  UnmapViewOfFile(data);
+#endif
+}
 
-  for (n=0; n<6; n++)
-    if (!strcmp(descriptions[n],mod.description))
-    {
-      desc = n;
-      break;
-    }
 
-  if (desc == -1)
-    return(MP_BADDESC);
 
-  switch (desc)
-  {
-    case 0: case 1: case 2: 
-      mod.number_channels = 4;
-      break;
-    case 3: case 5:
-      mod.number_channels = 8;
-      break;
-    case 4:
-      mod.number_channels = 6;
-      break;
-    default:
-      return(MP_BADDESC);
-  }  
+/* Gets a zeroed handle with a single reference.  The zeroed sample        */
+/* pointers are relied on by ModFree if a load fails half way.             */
+MPstatus NewModule(MPmodule** ret_module)
+{
+  MPstatus status;
+
+  if (!(*ret_module = (MPmodule*) calloc(1, sizeof(MPmodule))))
+    return(MP_NOMEM);
+  if ((status = MutexInit(&(*ret_module)->prep_lock)) != MP_OK)
+  {
+    free(*ret_module);
+    *ret_module = NULL;
+    return(status);
+  }
+  (*ret_module)->refs = 1;
   return(MP_OK);
 }
 
 
 
-/* Calls LoadModPattern correct number of times with correct parameters */
-/* Requires that both SetModHighestPattern and SetModNumberChannels     */
-/* were called previously                                               */
-MPstatus LoadModAllPatterns(FILE* mod_fd)
+/* Loads a mod from an open file.  The rest of the file is read in one go */
+/* into memory owned by the module, and the module is built over that the */
+/* same way as for ModLoadMemory.  The file may be closed afterwards.     */
+MPstatus ModLoad(FILE* mod_fd, MPmodule** ret_module)
 {
+  uint8* data;
+  uint32 size;
   MPstatus status;
-  int pattern;
-  for(pattern = 0; pattern <= mod.highest_pattern; pattern++)
-    if ((status = LoadModPattern(mod_fd, pattern, mod.number_channels))
-         != MP_OK)
-      return(status);
-  return(MP_OK);
+
+  if ((status = ReadModFile(mod_fd, &data, &size)) != MP_OK)
+    return(status);
+  if ((status = NewModule(ret_module)) != MP_OK)
+  {
+    free(data);
+    return(status);
+  }
+  (*ret_module)->image = data;
+  (*ret_module)->image_size = size;
+  if ((status = LoadModFromMemory(&(*ret_module)->data, data, size)) != MP_OK)
+  {
+    ModFree(*ret_module);
+    *ret_module = NULL;
+  }
+  return(status);
 }
 
 
 
-/* Presumes correct amount of space is already malloced                 */
-MPstatus LoadModSample(FILE* mod_fd, int8* mem_ptr, uint32 size)
+/* Maps the file and builds the module over the mapping (no sample copies) */
+/* The mapping belongs to the module and goes away with the last ModFree.  */
+MPstatus ModLoadFile(const char* songname, MPmodule** ret_module)
 {
-  int amt_to_read, num_read, n;
+  const uint8* data;
+  uint32 size;
+  MPstatus status;
+
+  if ((status = MapSong(songname, &data, &size)) != MP_OK)
+    return(status);
+  return(ModLoadMapped(data, size, ret_module));
+}
+
+
+
+/* Builds the module over a mapping from MapSong, which it takes over: it  */
+/* is unmapped with the last ModFree, or straight away if the load fails.  */
+MPstatus ModLoadMapped(const uint8* data, uint32 size, MPmodule** ret_module)
+{
+  MPstatus status;
 
-  while (size) 
+  if ((status = NewModule(ret_module)) != MP_OK)
   {
-    amt_to_read = (size < LOAD_BLK_SIZE) ? ((int) size) : LOAD_BLK_SIZE;
+    UnmapSong(data, size);
+    return(status);
+  }
+  (*ret_module)->image = data;
+  (*ret_module)->image_size = size;
+  (*ret_module)->image_mapped = 1;
+  if ((status = LoadModFromMemory(&(*ret_module)->data, data, size)) != MP_OK)
+  {
+    ModFree(*ret_module);
+    *ret_module = NULL;
+  }
+  return(status);
+}
 
-    if ((num_read = fread(mem_ptr, 1, amt_to_read, mod_fd)) == -1)
-      return(MP_BADFILE);
-    if (num_read == 0)
-      return(MP_UNEXPECTED_EOF);
 
-    /* Convert the signed byte samples to unsigned for the sound driver */
-    for(n=0; n<num_read; n++)
-      mem_ptr[n] ^= 0x80;
 
-    size -= num_read;      /* It's OK, num_read will be positive        */
-    mem_ptr += num_read;
+/* Builds the module over a caller-owned image.  The caller must keep data */
+/* valid until the last reference to the module has been freed.            */
+MPstatus ModLoadMemory(const uint8* data, uint32 size, MPmodule** ret_module)
+{
+  MPstatus status;
+
+  if ((status = NewModule(ret_module)) != MP_OK)
+    return(status);
+  if ((status = LoadModFromMemory(&(*ret_module)->data, data, size)) != MP_OK)
+  {
+    ModFree(*ret_module);
+    *ret_module = NULL;
   }
-  return(MP_OK);
+  return(status);
 }
 
 
 
-/* Note: Any NULL pointers in the sample array mean that sample doesn't */
-/* exist                                                                */
-MPstatus LoadModAllSamples(FILE* mod_fd)
+/* Reads the header and the patterns but none of the samples.  The file   */
+/* is kept open and each sample is read from it the first time            */
+/* ModGetSample asks for it, so playback can start straight away and      */
+/* samples that are never played are never read.  The sample pointers in */
+/* mod_data stay NULL until then: players must use ModGetSample.          */
+MPstatus ModLoadLazy(const char* songname, MPmodule** ret_module)
 {
-  int8 * mem_ptr;
+  struct mod_handle* module;
+  uint8 header[MOD_HEADER_SIZE];
+  uint8* buf;
+  uint32 size, pattern_size = 0, offset;
   MPstatus status;
   int n;
 
-  /* OK, this loop is tricky.  mem_ptr must be reset to NULL each time  */
-  /* just in case there is an intermediary sample with zero length      */
-  /* This avoids assuming that malloc(0) always returns NULL            */
+  if ((status = NewModule(ret_module)) != MP_OK)
+    return(status);
+  module = *ret_module;
+  if ((status = MutexInit(&module->lazy_lock)) != MP_OK)
+  {
+    ModFree(module);
+    *ret_module = NULL;
+    return(status);
+  }
+  if ((status = OpenSong(songname, &module->lazy_fd)) != MP_OK)
+  {
+    MutexDestroy(&module->lazy_lock);
+    ModFree(module);
+    *ret_module = NULL;
+    return(status);
+  }
+
+  if ((status = ModFileSize(module->lazy_fd, &size)) == MP_OK)
+  {
+    if ((size < MOD_HEADER_SIZE) ||
+        (fread(header, 1, MOD_HEADER_SIZE, module->lazy_fd) !=
+         MOD_HEADER_SIZE))
+      status = MP_BADFILE;
+    else if ((status = DecodeModHeader(&module->data, header)) == MP_OK &&
+             size < ModImageSize(&module->data))
+      status = MP_UNEXPECTED_EOF;
+  }
+
+  /* The patterns are read in one go and then thrown away                */
+  if (status == MP_OK)
+  {
+    pattern_size = (module->data.highest_pattern + 1) * MOD_NUM_DIVISIONS *
+                   module->data.number_channels * MOD_CELL_SIZE;
+    if (!(buf = (uint8*) malloc(pattern_size)))
+      status = MP_NOMEM;
+    else
+    {
+      if (fread(buf, 1, pattern_size, module->lazy_fd) != pattern_size)
+        status = MP_BADFILE;
+      else
+        status = DecodeModPatterns(&module->data, buf);
+      free(buf);
+    }
+  }
+
+  if (status != MP_OK)
+  {
+    ModFree(module);
+    *ret_module = NULL;
+    return(status);
+  }
 
-  for(n=0; n<MOD_NUM_SAMPLES; n++)
+  offset = MOD_HEADER_SIZE + pattern_size;
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
   {
-    mem_ptr = NULL;
+    module->sample_offset[n] = offset;
+    offset += module->data.sample_desc[n].length;
+  }
+  return(MP_OK);
+}
 
-    /* Note, we rely on short circuit evaluation here so that the       */
-    /* malloc is not called unnecessarily.  S/C eval is an ANSI feature */
 
-    if ((mod.sample_desc[n].length > 0) && 
-       (!(mem_ptr = (int8 *) malloc(mod.sample_desc[n].length))))
-      return(MP_NOMEM);
+
+/* The start of sample sample_no (0 based), or NULL if it has no data.     */
+/* For a lazily loaded module the sample is read in the first time (NULL   */
+/* comes back if that fails); otherwise it is just mod_data.sample.        */
+/* A sample_no outside the 31 samples also gets NULL.                      */
+/* Any number of players may call this at once.                            */
+const int8* ModGetSample(const MPmodule* module, int sample_no)
+{
+  /* Only the lazy part of the handle is changed, never the song           */
+  struct mod_handle* lazy = (struct mod_handle*) module;
+  uint32 length;
+  int8* sample;
+
+  if ((sample_no < 0) || (sample_no >= MOD_NUM_SAMPLES))
+    return(NULL);
+  length = module->data.sample_desc[sample_no].length;
+  if (!module->lazy_fd)
+    return(module->data.sample[sample_no]);
+
+  MutexLock(&lazy->lazy_lock);
+  if (!lazy->data.sample[sample_no] && (length > 0) &&
+      (sample = (int8*) malloc(length)))
+  {
+    if (fseek(lazy->lazy_fd, (long) lazy->sample_offset[sample_no],
+              SEEK_SET) ||
+        (fread(sample, 1, length, lazy->lazy_fd) != length))
+      free(sample);
     else
-      mod.sample[n]=mem_ptr;
+      lazy->data.sample[sample_no] = sample;
+  }
+  MutexUnlock(&lazy->lazy_lock);
+  return(lazy->data.sample[sample_no]);
+}
 
-    if (mem_ptr)
+
+
+/* Makes sure the samples played in the rows rows from song_pos/division  */
+/* on are in memory (see ModLoadLazy).  The rows are taken in song order  */
+/* without following jumps or breaks.  Does nothing for other modules.    */
+void ModPrefetchRows(const MPmodule* module, int song_pos, int division,
+                     int rows)
+{
+  const struct mod_data* mod = &module->data;
+  const struct mod_row* row;
+  uint32 n;
+
+  if (!module->lazy_fd)
+    return;
+  song_pos += division / MOD_NUM_DIVISIONS;
+  division %= MOD_NUM_DIVISIONS;
+  for (; (rows > 0) && (song_pos < mod->length); rows--)
+  {
+    row = MODROW(mod, mod->pattern_slot[mod->pattern_table[song_pos]],
+                 division);
+    for (n = row->first_event; n < row->first_event + row->number_events; n++)
+      if (mod->event[n].sample_number)
+        ModGetSample(module, mod->event[n].sample_number - 1);
+    if (++division == MOD_NUM_DIVISIONS)
     {
-      /* printf("\nCallLMS with length %d \n",mod.sample_desc[n].length);    */
-      status = LoadModSample(mod_fd, mem_ptr, mod.sample_desc[n].length);
-      if (status != MP_OK) return(status);
+      song_pos++;
+      division = 0;
     }
   }
+}
+
+
+
+/* Adds a reference.  Every player that wants to keep using the module     */
+/* should take its own and give it back with ModFree.                      */
+MPmodule* ModShare(MPmodule* module)
+{
+  ATOMICINC(module->refs);
+  return(module);
+}
+
+
+
+/* Drops a reference.  The last one frees everything the module owns.      */
+void ModFree(MPmodule* module)
+{
+  int n;
+
+  if (!module || ATOMICDEC(module->refs) > 0)
+    return;
+  if (module->image_mapped)
+    UnmapSong(module->image, module->image_size);
+  else
+    free((void*) module->image);
+  if (module->lazy_fd)
+  {
+    for (n = 0; n < MOD_NUM_SAMPLES; n++)
+      free((void*) module->data.sample[n]);
+    fclose(module->lazy_fd);
+    MutexDestroy(&module->lazy_lock);
+  }
+  MutexDestroy(&module->prep_lock);
+  for (n = 0; n < MOD_PREP_FORMATS; n++)
+    free(module->prep_block[n]);
+  free(module->data.pattern);
+  free(module->data.row);
+  free(module->data.event);
+  free(module);
+}
+
+
+
+/* All the memory the module holds: the file image, the compiled         */
+/* patterns, the prepared copies and, for a lazily loaded module, the     */
+/* samples read in so far.  A mapped image is counted although it may not */
+/* all be in memory.  A caller-owned image (ModLoadMemory) is not counted. */
+/* The prepared copies and lazy samples may grow while players use the    */
+/* module, so this is only what it holds at the time of the call.         */
+uint32 ModMemoryUsed(const MPmodule* module)
+{
+  /* Only the locks are taken, nothing is changed                         */
+  struct mod_handle* locked = (struct mod_handle*) module;
+  const struct mod_data* mod = &module->data;
+  uint32 used;
+  int n;
+
+  used = module->image_size + (uint32)
+         (mod->number_patterns * MOD_NUM_DIVISIONS *
+          (mod->number_channels * sizeof(uint32) + sizeof(struct mod_row)) +
+          mod->number_events * sizeof(struct mod_event));
+
+  /* A format being prepared isn't counted until it is done, rather than  */
+  /* waiting on prep_lock for the whole conversion                        */
+  for (n = 0; n < MOD_PREP_FORMATS; n++)
+    if (ATOMICGET(locked->prep_done[n]))
+      used += module->prep_size[n];
+
+  if (module->lazy_fd)
+  {
+    MutexLock(&locked->lazy_lock);
+    for (n = 0; n < MOD_NUM_SAMPLES; n++)
+      if (module->data.sample[n])
+        used += module->data.sample_desc[n].length;
+    MutexUnlock(&locked->lazy_lock);
+  }
+  return(used);
+}
+
+
+
+/* The song itself.  It is shared, so it must be treated as read-only.     */
+const struct mod_data* ModGetData(const MPmodule* module)
+{
+  return(&module->data);
+}
+
+
+
+/* Copies what the listing wants out of a decoded header                 */
+void SetModInfo(struct mod_info* info, const struct mod_data* mod,
+                uint32 file_size)
+{
+  int n;
+
+  memcpy(info->title, mod->title, MOD_TITLE_NAME_SIZE);
+  memcpy(info->sample_desc, mod->sample_desc, sizeof(info->sample_desc));
+  info->length = mod->length;
+  memcpy(info->pattern_table, mod->pattern_table, MOD_PATTERN_TABLE_SIZE);
+  info->highest_pattern = mod->highest_pattern;
+  memcpy(info->description, mod->description, MOD_DESC_SIZE+1);
+  info->number_channels = mod->number_channels;
+  info->number_patterns = mod->number_patterns;
+  info->number_samples = 0;
+  info->sample_bytes = 0;
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
+    if (mod->sample_desc[n].length > 0)
+    {
+      info->number_samples++;
+      info->sample_bytes += mod->sample_desc[n].length;
+    }
+  info->file_size = file_size;
+}
+
+
+
+/* Reads just the header of a mod (one MOD_HEADER_SIZE read from the      */
+/* current position) and fills in info.  No pattern or sample data is     */
+/* read and nothing is malloced.  The file is checked to be long enough   */
+/* to hold what the header describes, so a mod that probes MP_OK will     */
+/* also load.  The file position is left just after the header.           */
+MPstatus ModProbe(FILE* mod_fd, struct mod_info* info)
+{
+  struct mod_data mod;
+  uint8 buf[MOD_HEADER_SIZE];
+  uint32 size;
+  MPstatus status;
+
+  if ((status = ModFileSize(mod_fd, &size)) != MP_OK)
+    return(status);
+  if (fread(buf, 1, MOD_HEADER_SIZE, mod_fd) != MOD_HEADER_SIZE)
+    return(MP_BADFILE);
+  if ((status = DecodeModHeader(&mod, buf)) != MP_OK)
+    return(status);
+  if (size < ModImageSize(&mod))
+    return(MP_UNEXPECTED_EOF);
+  SetModInfo(info, &mod, size);
   return(MP_OK);
 }
 
 
 
-/* Given a valid mod file descriptor this function will completely load */
-/* the mod file data into both the mod structure and the samples array  */
-/* It is under debate as to whether a return should be executed upon    */
-/* the first noticed error or to logically "or" them all together      */
-MPstatus LoadMod(FILE* mod_fd)
-{  
+MPstatus ModProbeFile(const char* songname, struct mod_info* info)
+{
+  FILE* mod_fd;
   MPstatus status;
 
-  status = LoadModTitle(mod_fd) |
-           LoadModAllSampleDescriptions(mod_fd) |
-           LoadModLength(mod_fd) |
-           LoadModIgnore(mod_fd) |
-           LoadModPatternTable(mod_fd) |
-           LoadModDescription(mod_fd) |
-           SetModHighestPattern() |
-           SetModNumberChannels() |
-           LoadModAllPatterns(mod_fd) |
-           LoadModAllSamples(mod_fd); 
+  if ((status = OpenSong(songname, &mod_fd)) != MP_OK)
+    return(status);
+  status = ModProbe(mod_fd, info);
+  fclose(mod_fd);
+  return(status);
+}
+
+
 
-  return(status);  
+MPstatus ModProbeMemory(const uint8* data, uint32 size,
+                        struct mod_info* info)
+{
+  struct mod_data mod;
+  MPstatus status;
+
+  if (size < MOD_HEADER_SIZE)
+    return(MP_BADFILE);
+  if ((status = DecodeModHeader(&mod, data)) != MP_OK)
+    return(status);
+  if (size < ModImageSize(&mod))
+    return(MP_UNEXPECTED_EOF);
+  SetModInfo(info, &mod, size);
+  return(MP_OK);
+}
+
+
+
+/* Fills in prep (which already has length, loop_start and loop_length)   */
+/* and the buffer at dst, which has room for the guard samples before and */
+/* the unrolled ones after.  See mod.h.                                   */
+void PrepareSample(struct mod_prep_sample* prep, int format, void* dst,
+                   const int8* src)
+{
+  int16* d16 = (int16*) dst + MOD_PREP_GUARD;
+  float* df = (float*) dst + MOD_PREP_GUARD;
+  uint32 n = 0, end = prep->length;
+
+  if (format == MOD_PREP_INT16)
+  {
+    memset(d16 - MOD_PREP_GUARD, 0, MOD_PREP_GUARD * sizeof(int16));
+#ifdef HAVE_SSE2
+    /* Putting each byte in the high half of a word with a zero low byte  */
+    /* is just an unpack with zero, 16 samples at a time                  */
+    for (; n + 16 <= end; n += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*) (src + n));
+      _mm_store_si128((__m128i*) (d16 + n),
+                      _mm_unpacklo_epi8(_mm_setzero_si128(), v));
+      _mm_store_si128((__m128i*) (d16 + n + 8),
+                      _mm_unpackhi_epi8(_mm_setzero_si128(), v));
+    }
+#endif
+    for (; n < end; n++)
+      d16[n] = (int16) (src[n] * 256);
+    for (n = 0; n < MOD_PREP_UNROLL; n++)
+      d16[end + n] = prep->loop_length ?
+        d16[prep->loop_start + n % prep->loop_length] : 0;
+    prep->data = d16;
+  }
+  else
+  {
+    for (n = 0; n < MOD_PREP_GUARD; n++)
+      ((float*) dst)[n] = 0.0f;
+    for (n = 0; n < end; n++)
+      df[n] = src[n] * (1.0f / 128.0f);
+    for (n = 0; n < MOD_PREP_UNROLL; n++)
+      df[end + n] = prep->loop_length ?
+        df[prep->loop_start + n % prep->loop_length] : 0.0f;
+    prep->data = df;
+  }
 }
 
 
 
+/* Makes the format (MOD_PREP_INT16 or MOD_PREP_FLOAT) copies of all the  */
+/* samples described in mod.h.  They stay until the module is freed.     */
+/* Only the first call for a format does the work; any number of threads */
+/* may call this at once, on shared modules too, and ModGetPrepared sees  */
+/* none of the copies until they are all made.  For a lazily loaded       */
+/* module all the samples are read in.                                    */
+MPstatus ModPrepareSamples(const MPmodule* module, int format)
+{
+  /* Only the prepared part of the handle is changed, never the song      */
+  struct mod_handle* prep_mod = (struct mod_handle*) module;
+  const struct mod_samp_desc* desc;
+  struct mod_prep_sample* prep;
+  const int8* src[MOD_NUM_SAMPLES];
+  uint32 size = MOD_PREP_ALIGN, elem;
+  uint8* dst;
+  int n;
+
+  if ((format < 0) || (format >= MOD_PREP_FORMATS))
+    return(MP_BADARGS);
+  MutexLock(&prep_mod->prep_lock);
+  if (module->prep_block[format])
+  {
+    MutexUnlock(&prep_mod->prep_lock);
+    return(MP_OK);
+  }
+  elem = (format == MOD_PREP_INT16) ? sizeof(int16) : sizeof(float);
+
+  /* Work out the played part of each sample the way ResampleTick does   */
+  /* (DecodeModSampleDescription has kept the loop inside the data)       */
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
+  {
+    desc = &module->data.sample_desc[n];
+    prep = &prep_mod->prep[format][n];
+    memset(prep, 0, sizeof(*prep));
+    if (!(src[n] = ModGetSample(module, n)))
+      continue;
+    prep->length = desc->length;
+    if (desc->repeat_length > 2)
+    {
+      prep->loop_start = desc->repeat_point;
+      prep->loop_length = desc->repeat_length;
+      prep->length = prep->loop_start + prep->loop_length;
+    }
+    size += (MOD_PREP_GUARD + prep->length + MOD_PREP_UNROLL) * elem +
+            MOD_PREP_ALIGN;
+  }
+
+  if (!(prep_mod->prep_block[format] = malloc(size)))
+  {
+    MutexUnlock(&prep_mod->prep_lock);
+    return(MP_NOMEM);
+  }
+  prep_mod->prep_size[format] = size;
+
+  /* Each sample starts on a boundary (the guard size keeps the sample    */
+  /* itself aligned too)                                                   */
+  dst = PREPALIGN(prep_mod->prep_block[format]);
+  for (n = 0; n < MOD_NUM_SAMPLES; n++)
+  {
+    prep = &prep_mod->prep[format][n];
+    if (!src[n])
+      continue;
+    PrepareSample(prep, format, dst, src[n]);
+    dst = PREPALIGN(dst + (MOD_PREP_GUARD + prep->length + MOD_PREP_UNROLL) *
+                    elem);
+  }
+  ATOMICINC(prep_mod->prep_done[format]);
+  MutexUnlock(&prep_mod->prep_lock);
+  return(MP_OK);
+}
+
 
 
+/* sample_no's copy in format, or NULL if ModPrepareSamples was not called */
+/* for format or the sample has no data                                    */
+const struct mod_prep_sample* ModGetPrepared(const MPmodule* module,
+                                             int format, int sample_no)
+{
+  struct mod_handle* prep_mod = (struct mod_handle*) module;
 
+  if ((format < 0) || (format >= MOD_PREP_FORMATS) ||
+      !ATOMICGET(prep_mod->prep_done[format]) ||
+      !module->prep[format][sample_no].data)
+    return(NULL);
+  return(&module->prep[format][sample_no]);
+}
@@ -19,13 +19,50 @@
 
 MPstatus ParseCommandLine(int argc, char** argv, char* ret_filename);
 MPstatus OpenSong(const char* filename, FILE** ret_fd);
-/* CloseSong still needs to be done...Don't forget to free all the memory    */
-/* malloced by LoadModAllSamples as well as close the file                   */
+/* CloseSong still needs to be done...  For now fclose the file yourself.    */
+/* The memory used by a mod is given back by ModFree (below).                */
 /* Note: The above two fn's should eventually be part of a different         */
 /* subsystem as they are not specific to PT mod files                        */
 
 
-MPstatus LoadMod(FILE* fd);
+MPstatus MapSong(const char* filename, const uint8** ret_data,
+                 uint32* ret_size);
+void     UnmapSong(const uint8* data, uint32 size);
+
+
+/* A loaded module.  Any number of modules may be loaded at once, and one   */
+/* module may be shared (read-only) by several players via ModShare.        */
+/* Every load and every ModShare must be matched by a ModFree.              */
+typedef struct mod_handle MPmodule;
+
+MPstatus  ModLoad(FILE* fd, MPmodule** ret_module);
+MPstatus  ModLoadFile(const char* filename, MPmodule** ret_module);
+MPstatus  ModLoadMemory(const uint8* data, uint32 size, MPmodule** ret_module);
+/* ModLoadMemory uses data in place; it must outlive the module.             */
+MPstatus  ModLoadMapped(const uint8* data, uint32 size, MPmodule** ret_module);
+/* ModLoadMapped takes over a mapping from MapSong, even if it fails.        */
+MPstatus  ModLoadLazy(const char* filename, MPmodule** ret_module);
+/* ModLoadLazy reads samples on first use.  See ModGetSample.                */
+MPmodule* ModShare(MPmodule* module);
+void      ModFree(MPmodule* module);
+const struct mod_data* ModGetData(const MPmodule* module);
+uint32    ModMemoryUsed(const MPmodule* module);
+const int8* ModGetSample(const MPmodule* module, int sample_no);
+void      ModPrefetchRows(const MPmodule* module, int song_pos, int division,
+                          int rows);
+
+/* Resampler-friendly copies of the samples (see mod_prep_sample in mod.h)   */
+MPstatus  ModPrepareSamples(const MPmodule* module, int format);
+const struct mod_prep_sample* ModGetPrepared(const MPmodule* module,
+                                             int format, int sample_no);
+
+
+/* Header-only look at a mod, for listings and indexes (see modindex.h).    */
+/* Only the first MOD_HEADER_SIZE bytes are read; samples are not touched.  */
+MPstatus ModProbe(FILE* fd, struct mod_info* ret_info);
+MPstatus ModProbeFile(const char* filename, struct mod_info* ret_info);
+MPstatus ModProbeMemory(const uint8* data, uint32 size,
+                        struct mod_info* ret_info);
 
 #endif
 
@@ -16,7 +16,6 @@
 #include "mixer.h"
 #include "ptplay.h"
 
-/* extern struct mod_data mod;  has been put in mod.h */
 
 /* This getline fn was taken from K&R.  */
 int getline(char s[], int lim)
@@ -37,7 +36,8 @@ int main(int argc, char** argv)
 {
   MPstatus status;
   char modname[256];
-  FILE* mod_fd;
+  MPmodule* module;
+  const struct mod_data* mod;
   int n;
   int rate, res;
   char line[80];
@@ -45,53 +45,51 @@ int main(int argc, char** argv)
   if ((status = ParseCommandLine(argc, argv, modname)) != MP_OK)
     ExitError(status);
 
-  if ((status = OpenSong(modname, &mod_fd)) != MP_OK)
-    ExitError(status);
-
-  if ((status = LoadMod(mod_fd)) != MP_OK)
+  if ((status = ModLoadFile(modname, &module)) != MP_OK)
     ExitError(status);
+  mod = ModGetData(module);
 
   printf("\nMODify v0.1   Protracker, Noisetracker, Soundtracker Module Player\n");
   printf("Copyright 1996 Tristan Grimmer.  All rights reserved.\n\n");
 
   printf("Built on %s by %s, at %s\n\n", HOST, USER, DATE);
 
-  printf("MOD TITLE: %s\n", mod.title);
+  printf("MOD TITLE: %s\n", mod->title);
   printf("-----------------------------------------------------------------------------\n");
   printf("| SAMP# |      INSTR NAME        |  LEN  | FTUNE | DVOL | REP_PNT | REP_LEN |\n");
   printf("-----------------------------------------------------------------------------\n");
   for(n=0; n<MOD_NUM_SAMPLES;n++)
   {
-    if (mod.sample_desc[n].length)
+    if (mod->sample_desc[n].length)
     {
-      printf("| %2d    | %22.22s ", n+1, mod.sample_desc[n].name);
+      printf("| %2d    | %22.22s ", n+1, mod->sample_desc[n].name);
       printf("| %5u |  %2u   | %3u  |  %5u  |  %5u  |\n",
-        mod.sample_desc[n].length, mod.sample_desc[n].finetune,
-        mod.sample_desc[n].volume, mod.sample_desc[n].repeat_point,
-        mod.sample_desc[n].repeat_length);
+        mod->sample_desc[n].length, mod->sample_desc[n].finetune,
+        mod->sample_desc[n].volume, mod->sample_desc[n].repeat_point,
+        mod->sample_desc[n].repeat_length);
     }
   }
   printf("-----------------------------------------------------------------------------\n");
-  printf("SONG LENGTH: %u  ", mod.length);
-  printf("IGNORE: %u  ", mod.ignore);
+  printf("SONG LENGTH: %u  ", mod->length);
+  printf("IGNORE: %u  ", mod->ignore);
 /*  printf("SONG PATTERN TABLE: ");
-  for(n=0; n<MOD_PATTERN_TABLE_SIZE; n++) printf("%u, ",mod.pattern_table[n]);
+  for(n=0; n<MOD_PATTERN_TABLE_SIZE; n++) printf("%u, ",mod->pattern_table[n]);
   printf("\n");*/
 
-  printf("DESCRIP: %s\n", mod.description);
+  printf("DESCRIP: %s\n", mod->description);
 
   
  
-/*  for(l=0; l <= mod.highest_pattern; l++)
+/*  for(l=0; l < mod->number_patterns; l++)
     for(n=0; n<MOD_NUM_DIVISIONS; n++)
-       for(m=0; m<mod.number_channels; m++)
-         printf("PATTERN: %d  DIVISION: %d  CHANNEL: %d  sample_no: %u  period: %u  effect: %x  argx: %x  argy: %x\n",l, n, m+1,
-                 mod.pattern[l][n][m].sample_number,
-                 mod.pattern[l][n][m].period,
-                 mod.pattern[l][n][m].effect, mod.pattern[l][n][m].argx, mod.pattern[l][n][m].argy); */
+       for(m=0; m<mod->number_channels; m++)
+         printf("SLOT: %d  DIVISION: %d  CHANNEL: %d  sample_no: %u  period: %u  effect: %x  argx: %x  argy: %x\n",l, n, m+1,
+                 MODCELLSAMPLE(MODCELL(mod, l, n, m)),
+                 MODCELLPERIOD(MODCELL(mod, l, n, m)),
+                 MODCELLEFFECT(MODCELL(mod, l, n, m)), MODCELLARGX(MODCELL(mod, l, n, m)), MODCELLARGY(MODCELL(mod, l, n, m))); */
  
-  printf("CHANS: %u\n", mod.number_channels);
-/*  printf("HIGHEST PATTERN: %u\n", mod.highest_pattern); */
+  printf("CHANS: %u\n", mod->number_channels);
+/*  printf("HIGHEST PATTERN: %u\n", mod->highest_pattern); */
 
 /*  printf("PLAYING SAMPLES\n");
 
@@ -106,12 +104,13 @@ int main(int argc, char** argv)
   sscanf(line, "%d", &rate);
   res = 8;
 /*  if ((status = MixerInitialize(rate, res, CHANNEL1 | CHANNEL4, CHANNEL2 | CHANNEL3)) */
-  if ((status = MixerInitialize(rate, res, CHANNEL1 | CHANNEL4 | CHANNEL2 | CHANNEL3, 0))
+  if ((status = MixerInitialize(rate, res, MIXERCHANMASK(mod->number_channels), 0))
              != MP_OK) ExitError(status);
 
   printf("Using Rate: %d\n", MixerGetRate());
 
-  PlayMod();
+  PlayMod(module);
+  ModFree(module);
 
   printf("\nExiting...\n");
   return 0;
@@ -51,7 +51,9 @@ static struct
   int out;
 } mixer;
 
-static int divtable[] = { 0, 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+/* The shift that divides the sum of n channels back down, for n = 0..32 */
+static int divtable[] = { 0, 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+                          5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5 };
   
 static int FlushAvail(void);
 static int WriteAvail(int channel_index);
@@ -87,6 +89,13 @@ int MixerGetRate(void)
 
 
 
+int MixerGetResolution(void)
+{
+  return(mixer.res);
+}
+
+
+
 /* If either left or right contains no channels the mixer should initialize  */
 /* to mono mode.  This function MUST be called prior to using the mixer.     */
 /* The actual rate parameter used will be returned in *rate                  */
@@ -104,7 +113,8 @@ MPstatus MixerInitialize(int rate, int resolution, int left, int right)
   if (err != paNoError)
 	  return(MP_UNAVAIL_DSP);
 
-  if ((resolution == 8) || (resolution == 16))
+  if ((resolution == 8) || (resolution == 16) ||
+      (resolution == MIXER_RES_FLOAT))
     mixer.res = resolution;
   else
     return(MP_DSP_BADARG);
@@ -115,7 +125,8 @@ MPstatus MixerInitialize(int rate, int resolution, int left, int right)
   outputParameters.sampleFormat = paInt16; /*resolution == 16 ? paInt16 : paUInt8;*/ //PA_SAMPLE_TYPE;
   outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputParameters.device )->defaultHighOutputLatency;
   outputParameters.hostApiSpecificStreamInfo = NULL;
-  if ((resolution == 8) || (resolution == 16))
+  if ((resolution == 8) || (resolution == 16) ||
+      (resolution == MIXER_RES_FLOAT))
     mixer.res = resolution;
   else
     return(MP_DSP_BADARG);
@@ -189,7 +200,8 @@ MPstatus MixerInitialize(int rate, int resolution, int left, int right)
   if (ioctl(dspfd, SNDCTL_DSP_SAMPLESIZE, &real_res) == -1)
     return(MP_DSP_ERROR);
 
-  if ((resolution == 8) || (resolution == 16))
+  if ((resolution == 8) || (resolution == 16) ||
+      (resolution == MIXER_RES_FLOAT))
     mixer.res = resolution;
   else
     return(MP_DSP_BADARG);
@@ -300,8 +312,10 @@ int WriteAvail(int ch_index)
 /* I require the user to supply the channel number (= index + 1)         */
 int MixerGetChanIndex(int channel_id)
 {
+  /* unsigned, or channel 32 would never shift down to 0                 */
+  uint32 id = (uint32) channel_id;
   int index = 0;
-  while (channel_id >>= 1) index++;
+  while (id >>= 1) index++;
   return(index);
 }
 
@@ -309,41 +323,64 @@ int MixerGetChanIndex(int channel_id)
 
 int MixerGetChanID(int channel_index)
 {
-  return(1 << channel_index);
+  return((int) (1UL << channel_index));
 }
 
 
 
 /* length should contain the number of individual samples (be they 8 or  */
-/* 16 bit).  The return value of length is the number of samples that    */
-/* STILL NEED TO BE WRITTEN... not the number written (it's more useful) */
-/* void** is chosen for the samples pointer since as the data may be 8 or*/
-/* 16 bit. *void is incremented by the number of samples mixed on return */
-int Mix(int channel, uint8** samp_ptr, int length)
+/* 16 bit, or float).  The return value of length is the number of      */
+/* samples that STILL NEED TO BE WRITTEN... not the number written (it's */
+/* more useful).  void** is chosen for the samples pointer since the     */
+/* data may be any of them. *void is moved on past the samples mixed.    */
+/* The signed ones are summed as two's complement in the 32bit slots.    */
+/* A NULL *void is silence: the channel moves on with nothing added.     */
+int Mix(int channel, void** samp_ptr, int length)
 {
   int length_avail, side, n, buf_add, index;
   int ch_index  = MixerGetChanIndex(channel);
   void* samples = *samp_ptr;
   uint8* samp8  = (uint8*) samples;
   int16* samp16 = (int16*) samples;
+  float* sampf  = (float*) samples;
 
   side = ((channel & mixer.right) && mixer.stereo) ? 1 : 0;
   buf_add = mixer.in[ch_index] + side;
   length_avail = WriteAvail(ch_index);
   if (length_avail > length) length_avail = length;
 
-  for (n = 0; n < length_avail; n++)
+  switch (samples ? mixer.res : 0)
   {
-    index = ((n << mixer.stereo) + buf_add) % mixer.bufsize;
-    mixer.buffer[index] += 
-      (mixer.res >> 4) ? *samp16++ : *samp8++;    
+  case 0:   /* silence: the slots are 0 until flushed, so nothing to add */
+    break;
+  case 8:
+    for (n = 0; n < length_avail; n++)
+    {
+      index = ((n << mixer.stereo) + buf_add) % mixer.bufsize;
+      mixer.buffer[index] += *samp8++;
+    }
+    break;
+  case 16:
+    for (n = 0; n < length_avail; n++)
+    {
+      index = ((n << mixer.stereo) + buf_add) % mixer.bufsize;
+      mixer.buffer[index] += (uint32) (int) *samp16++;
+    }
+    break;
+  default:
+    for (n = 0; n < length_avail; n++)
+    {
+      index = ((n << mixer.stereo) + buf_add) % mixer.bufsize;
+      mixer.buffer[index] += (uint32) (int) (*sampf++ * 32768.0f);
+    }
+    break;
   }
   mixer.in[ch_index] = (mixer.in[ch_index] +
                        (length_avail << mixer.stereo)) % mixer.bufsize;
 
   /* if all of sample written, leave samp_ptr at the beginning          */
-  /* todo: should this depend on sample size and stereo?                */
-  *samp_ptr += length_avail;
+  if (samples)
+    *samp_ptr = (uint8*) *samp_ptr + length_avail * (mixer.res >> 3);
   MixerFlush();
   return(length - length_avail);
 }
@@ -353,7 +390,7 @@ int Mix(int channel, uint8** samp_ptr, int length)
 /* Here's the code to flush the buffer. (if able)                       */
 MPstatus MixerFlush(void)
 {
-  int length_avail, flush_blocks, nl, nr, n, s;
+  int length_avail, flush_blocks, nl, nr, n, s, sum;
   int lch_lshift, lch_rshift, rch_lshift, rch_rshift;
 #ifndef PLAT_LINUX
   PaError err;
@@ -396,20 +433,34 @@ MPstatus MixerFlush(void)
 
   /* now one of the right or left shifts will be zero so no loss of     */
   /* significant digits.  We also have no loss if we mix 8bit data!     */
+  /* The signed sums only ever shift right, and are clipped since a     */
+  /* float may be a little over full scale.                             */
   for (n = 0; n < flush_blocks; n++)
   {
-    for(s = 0; s < mixer.blocksize; s += 2)
+    if (mixer.res == 8)
     {
-      mixer.flushbuf[s] = (mixer.buffer[(s + mixer.out) % mixer.bufsize])
-                          << lch_lshift >> lch_rshift ^ 0x8000;
-      mixer.buffer[(s + mixer.out) % mixer.bufsize] = 0;
+      for(s = 0; s < mixer.blocksize; s += 2)
+      {
+        mixer.flushbuf[s] = (mixer.buffer[(s + mixer.out) % mixer.bufsize])
+                            << lch_lshift >> lch_rshift ^ 0x8000;
+        mixer.buffer[(s + mixer.out) % mixer.bufsize] = 0;
+      }
+      for(s = 1; s < mixer.blocksize; s += 2)
+      {
+        mixer.flushbuf[s] = (mixer.buffer[(s + mixer.out) % mixer.bufsize]) 
+                            << rch_lshift >> rch_rshift ^ 0x8000;
+        mixer.buffer[(s + mixer.out) % mixer.bufsize] = 0;
+      }
     }
-    for(s = 1; s < mixer.blocksize; s += 2)
-    {
-      mixer.flushbuf[s] = (mixer.buffer[(s + mixer.out) % mixer.bufsize]) 
-                          << rch_lshift >> rch_rshift ^ 0x8000;
-      mixer.buffer[(s + mixer.out) % mixer.bufsize] = 0;
-    } 
+    else
+      for(s = 0; s < mixer.blocksize; s++)
+      {
+        sum = (int) mixer.buffer[(s + mixer.out) % mixer.bufsize] >>
+              ((s & 1) ? rch_rshift : lch_rshift);
+        mixer.flushbuf[s] = (uint16) ((sum < -32768) ? -32768 :
+                                      (sum > 32767) ? 32767 : sum);
+        mixer.buffer[(s + mixer.out) % mixer.bufsize] = 0;
+      }
 #ifdef PLAT_LINUX
     to_write = mixer.blocksize << 1;          /* To get number of bytes */
     while (to_write)
@@ -433,7 +484,7 @@ MPstatus MixerFlush(void)
 
 
 #ifdef PLAT_LINUX
-MPstatus MixerPlaySamples(void)
+MPstatus MixerPlaySamples(const struct mod_data* mod)
 {
   unsigned char buf[32768];
   int dsp_fd, n, w;
@@ -454,9 +505,10 @@ MPstatus MixerPlaySamples(void)
 
   for(n=0; n<MOD_NUM_SAMPLES; n++)
   {
-    printf("Sample %d  Length %d\n", n, mod.sample_desc[n].length);
-    for(m=0; m<mod.sample_desc[n].length; m++) buf[m] = mod.sample[n][m]; 
-    w = write(dsp_fd, buf, mod.sample_desc[n].length);
+    printf("Sample %d  Length %d\n", n, mod->sample_desc[n].length);
+    for(m=0; m<mod->sample_desc[n].length; m++)
+      buf[m] = SAMPLETOUNSIGNED(mod->sample[n][m]);
+    w = write(dsp_fd, buf, mod->sample_desc[n].length);
     
     printf("Sample %d  NumWritten %d\n", n, w);
   } 
@@ -33,6 +33,10 @@
 #define MONO 0
 #define DEFAULT_RATE 22050
 #define DEFAULT_RESOLUTION 8
+#define MIXER_RES_FLOAT 32
+/* The resolution is that of the samples given to Mix: unsigned 8 bit,       */
+/* signed 16 bit or MIXER_RES_FLOAT (-1.0 to 1.0).  They are summed as they  */
+/* are; the device is always sent 16 bits.                                   */
 
 
 /* The available channels.  More may need to be added later                  */
@@ -49,15 +53,20 @@ enum
   CHANNEL8 =      128
 };
 
+/* All of the first n channels, e.g. for a mod with n channels            */
+#define MIXERCHANMASK(n) \
+  ((int) (((n) >= 32) ? 0xFFFFFFFFUL : ((1UL << (n)) - 1)))
+
 
 
 /* This should eventually be inserted by the makefile */
 #define DSP_DEV       "/dev/dsp"
 
-MPstatus MixerPlaySamples(void);          /* This is just a function used for testing */
+MPstatus MixerPlaySamples(const struct mod_data* mod); /* just used for testing */
 MPstatus MixerChangeRate(int* new_rate);
 MPstatus MixerChangeResolution(int* new_resolution);
 int      MixerGetRate(void);
+int      MixerGetResolution(void);
 int      MixerGetChanIndex(int channel_id);
 int      MixerGetChanID(int channel_index);
 MPstatus MixerInitialize(int rate, int res, int left, int right);
@@ -38,7 +38,8 @@ typedef enum
   MP_DSP_ERROR       = 128,
   MP_DSP_BADARG      = 256,
   MP_BADEFFECT       = 512,        /* Invalid effect or effect arguments     */
-  MP_BADJUMPEFFECT   = 1024        /* Invalid jump effect parameters         */
+  MP_BADJUMPEFFECT   = 1024,       /* Invalid jump effect parameters         */
+  MP_NOTHREAD        = 2048        /* a worker thread could not be started   */
 
   /* others to be added as we go */
 } MPstatus;
@@ -51,10 +52,20 @@ typedef unsigned char uint8;
 typedef signed char int8;
 typedef unsigned int uint32;
 typedef signed short int int16;
+typedef unsigned long long uint64;
 
 
-#define LOAD_BLK_SIZE 1024    /* A good size for reading file chunks         */
-                              /* This value should be checked for efficiency */
+/* SSE2 is used for some of the bulk loops when the compiler says it is     */
+/* available (it always is for x64).  There is always a plain C version.     */
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define HAVE_SSE2
+#endif
+
+/* Mod samples are stored as signed bytes.  The sound path wants unsigned    */
+/* ones, so the conversion is done as the sample is read out for mixing.     */
+/* This lets the sample data be used straight from the file image.           */
+#define SAMPLETOUNSIGNED(s) ((uint8) ((s) ^ 0x80))
 
 /* These definitions are just for protracker mods                            */
 #define MOD_PATTERN_TABLE_SIZE 128
@@ -63,10 +74,13 @@ typedef signed short int int16;
 #define MOD_TITLE_NAME_SIZE 20
 #define MOD_NUM_SAMPLES 31         /* ones with 15 have 0 length in the rest */
 #define MOD_CHANNELS 4
-#define MOD_MAX_CHANNELS 8         /* most mods use only 4 but max is 8      */
+#define MOD_MAX_CHANNELS 32        /* most mods use only 4 but xxCH go to 32 */
 #define MOD_PATTERNS 64            /* although 64 is the most common value   */
 #define MOD_MAX_PATTERNS  128      /* protracker may use more                */
 #define MOD_NUM_DIVISIONS 64
+#define MOD_SAMPLE_DESC_SIZE 30    /* bytes per sample description in file  */
+#define MOD_CELL_SIZE 4            /* bytes per channel per division in file */
+#define MOD_HEADER_SIZE 1084       /* everything up to the first pattern     */
 #define MOD_EXTENSION "mod"
 
 
@@ -81,26 +95,72 @@ struct mod_samp_desc
   uint32 repeat_length;            /* hold byte values, not number of words  */
 };
 
-struct mod_channel_info            
+/* The channel data for one division is packed into a single uint32 cell:   */
+/*   bits 31..24 sample number, 23..12 period, 11..8 effect,                 */
+/*   bits  7..4  effect argx,     3..0  effect argy                          */
+/* These macros take it apart again.  They are just shifts and masks.        */
+#define MODCELLSAMPLE(c) ((uint8) ((c) >> 24))
+#define MODCELLPERIOD(c) ((uint16) (((c) >> 12) & 0x0FFF))
+#define MODCELLEFFECT(c) ((uint8) (((c) >> 8) & 0x0F))
+#define MODCELLARGX(c)   ((uint8) (((c) >> 4) & 0x0F))
+#define MODCELLARGY(c)   ((uint8) ((c) & 0x0F))
+
+#define MOD_NO_SLOT 0xFF           /* pattern_slot value of dropped patterns */
+
+/* The player does not walk the patterns themselves.  At load time they are  */
+/* compiled into a stream of events, one per non-empty cell, with the        */
+/* effect arguments already picked apart.  Each division (row) of each slot  */
+/* has a mod_row giving its events and the flow effects (jump, break,        */
+/* speed, pattern loop and delay) of the whole row, so the player never has  */
+/* to look for them.                                                         */
+struct mod_event
 {
+  uint8 channel;
   uint8 sample_number;
-  uint16 period;                   /* Only 12 LS bits used for both          */
+  uint16 period;
   uint8 effect;
   uint8 argx;
   uint8 argy;
+  uint8 arg;                       /* (argx << 4) + argy                     */
+};
+
+/* mod_row flags                                                             */
+#define MOD_ROW_JUMP     0x01      /* Bxx: go to order jump_pos              */
+#define MOD_ROW_BREAK    0x02      /* Dxx: go to division break_row          */
+#define MOD_ROW_SPEED    0x04      /* Fxx, xx < 32: ticks per division       */
+#define MOD_ROW_TEMPO    0x08      /* Fxx, xx >= 32: beats per minute        */
+#define MOD_ROW_BADJUMP  0x10      /* Bxx or Dxx with an illegal argument    */
+#define MOD_ROW_LOOP     0x20      /* E6x: pattern loop, x times (0: start)  */
+#define MOD_ROW_DELAY    0x40      /* EEx: play the row x more times         */
+
+struct mod_row
+{
+  uint32 first_event;              /* index into the event array             */
+  uint8 number_events;
+  uint8 flags;
+  uint8 jump_pos;
+  uint8 break_row;
+  uint8 speed;
+  uint8 tempo;
+  uint8 loop;
+  uint8 delay;
 };
 
 /* The mod_data structure can be used to access any of the mod file's fields */
 /* except for the sample data                                                */
-/* The patterns array (although a slight waste of space... the speed is      */
-/* necessary) allows access to any piece of channel data in a pattern        */
-/* Usage would be: pattern[pattern_no 0..MOD_MAX_PATTERNS-1]                 */
-/*                        [division_no 0..MOD_NUM_DIVISIONS-1]               */
-/*                        [channel no 0..MOD_MAX_CHANNELS-1].period etc.     */
-/* The contents will be copied from the mod file to the appropriate place    */
+/* Only the patterns the song can reach (those in the first length entries   */
+/* of the pattern table) are kept.  Each gets a slot in the pattern array,   */
+/* which holds number_patterns * MOD_NUM_DIVISIONS * number_channels cells   */
+/* and no more.  pattern_slot maps a pattern number to its slot.  Use the    */
+/* MODCELL macro to get at a cell:                                           */
+/*   MODCELL(mod, mod->pattern_slot[pattern_no], division_no, channel_no)    */
 /* The sample array is just an array of pointers to the start of each        */
 /* sample.  Usage would be: mod.sample[sample_no 0..MOD_NUM_SAMPLES]         */
 /*                                [index_into_sample 0..sample_desc.length]  */
+/* The samples are the signed bytes exactly as they appear in the file.  If  */
+/* the mod was loaded with ModLoadFile or ModLoadMemory they point into the  */
+/* file image, so they are never written to.  If it was loaded with          */
+/* ModLoadLazy they are NULL until read in by ModGetSample.                  */
 struct mod_data
 {
   char title[MOD_TITLE_NAME_SIZE];
@@ -111,14 +171,62 @@ struct mod_data
   uint8 highest_pattern;
   char description[MOD_DESC_SIZE+1]; /* Is this always present ??            */
   uint8 number_channels;
-  struct mod_channel_info pattern[MOD_MAX_PATTERNS]
-                                 [MOD_NUM_DIVISIONS]
-                                 [MOD_MAX_CHANNELS];
-  uint8*  sample[MOD_NUM_SAMPLES];
+  uint8 number_patterns;           /* number of slots in pattern             */
+  uint8 pattern_slot[MOD_MAX_PATTERNS];
+  uint32* pattern;                 /* packed cells, slot by slot             */
+  struct mod_row* row;             /* number_patterns * MOD_NUM_DIVISIONS    */
+  struct mod_event* event;         /* all the events, in row order           */
+  uint32 number_events;
+  const int8* sample[MOD_NUM_SAMPLES];
+};
+
+#define MODCELL(m, slot, div, chan)                                        \
+  ((m)->pattern[((slot) * MOD_NUM_DIVISIONS + (div)) * (m)->number_channels \
+                + (chan)])
+
+#define MODROW(m, slot, div) (&(m)->row[(slot) * MOD_NUM_DIVISIONS + (div)])
+
+/* ModPrepareSamples can make copies of the samples that are easier for a  */
+/* resampler to use: widened to int16 (the byte in the high half) or to     */
+/* float (-1.0 .. 1.0), aligned to MOD_PREP_ALIGN bytes, and padded so that */
+/* reads a little outside the played part need no checks.  Before sample 0  */
+/* are MOD_PREP_GUARD zero samples.  After the end (the end of the loop if  */
+/* there is one, else of the sample) are MOD_PREP_UNROLL more samples: the  */
+/* loop repeated over and over, or zeros for a sample that doesn't loop.    */
+#define MOD_PREP_INT16 0
+#define MOD_PREP_FLOAT 1
+#define MOD_PREP_FORMATS 2
+#define MOD_PREP_ALIGN 16
+#define MOD_PREP_GUARD 16
+#define MOD_PREP_UNROLL 64
+
+struct mod_prep_sample
+{
+  const void* data;                /* int16* or float*, points at sample 0   */
+  uint32 length;                   /* samples up to the end (see above)      */
+  uint32 loop_start;
+  uint32 loop_length;              /* 0 if the sample doesn't loop           */
+};
+
+/* What ModProbe can tell about a mod from its header alone.  The fields    */
+/* with the same names as in mod_data mean the same thing.  number_samples  */
+/* counts the samples that have any data and sample_bytes is their total    */
+/* size.  file_size is the size of the whole file.                          */
+struct mod_info
+{
+  char title[MOD_TITLE_NAME_SIZE];
+  struct mod_samp_desc sample_desc[MOD_NUM_SAMPLES];
+  uint8 length;
+  uint8 pattern_table[MOD_PATTERN_TABLE_SIZE];
+  uint8 highest_pattern;
+  char description[MOD_DESC_SIZE+1];
+  uint8 number_channels;
+  uint8 number_patterns;
+  uint8 number_samples;
+  uint32 sample_bytes;
+  uint32 file_size;
 };
 
-/* Note:  No initialization necessary since it's declared globally           */
-extern struct mod_data mod;
   
 
 #endif
@@ -0,0 +1,97 @@
+/*****************************************************************************/
+/* modbench.c v0.1            Loader Benchmark                               */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 09:30:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments: A program of its own, not part of the player.  See README.md.   */
+/*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mod.h"
+#include "loadmod.h"
+
+#define BENCH_DEFAULT_LOADS 200    /* of each file, if not given            */
+
+
+static double LoadSeconds(const char* filename, int loads, uint32* ret_size);
+
+
+
+/* modbench [-n loads] file.mod ...                                          */
+/* Loads each file loads times with ModLoadFile (one read of the whole file, */
+/* then the pattern decode and sample conversion) and prints the time per    */
+/* load and the rate, then the same for all the files together.              */
+int main(int argc, char** argv)
+{
+  int loads = BENCH_DEFAULT_LOADS, first = 1, n;
+  double seconds, total_seconds = 0.0, total_bytes = 0.0;
+  uint32 size;
+
+  if ((argc > 2) && (argv[1][0] == '-') && (argv[1][1] == 'n'))
+  {
+    loads = atoi(argv[2]);
+    first = 3;
+  }
+  if ((loads <= 0) || (first >= argc))
+  {
+    printf("usage: modbench [-n loads] file.mod ...\n");
+    return(1);
+  }
+
+  printf("%-32s %10s %10s %10s\n", "file", "bytes", "us/load", "MB/s");
+  for (n = first; n < argc; n++)
+  {
+    seconds = LoadSeconds(argv[n], loads, &size);
+    printf("%-32s %10lu %10.1f %10.1f\n", argv[n], (unsigned long) size,
+           seconds * 1e6 / loads, (double) size * loads / seconds / 1e6);
+    total_seconds += seconds;
+    total_bytes += (double) size * loads;
+  }
+  printf("%-32s %10.0f %10.1f %10.1f\n", "all", total_bytes / loads,
+         total_seconds * 1e6 / ((double) loads * (argc - first)),
+         total_bytes / total_seconds / 1e6);
+  return(0);
+}
+
+
+
+/* Loads and frees filename loads times, giving back the file size too.      */
+/* The first load is not timed, so every timed one finds the file in the OS  */
+/* cache.  Any failure to load is fatal, as a benchmark that skips files is  */
+/* no good for comparing.                                                    */
+double LoadSeconds(const char* filename, int loads, uint32* ret_size)
+{
+  struct mod_info info;
+  MPmodule* module;
+  MPstatus status;
+  FILE* fd;
+  clock_t start;
+  int n;
+
+  if (((status = OpenSong(filename, &fd)) != MP_OK) ||
+      ((status = ModProbe(fd, &info)) != MP_OK) ||
+      ((status = ModLoadFile(filename, &module)) != MP_OK))
+  {
+    printf("modbench: can't load %s (MPstatus %d)\n", filename, status);
+    exit(1);
+  }
+  fclose(fd);
+  ModFree(module);
+  *ret_size = info.file_size;
+
+  start = clock();
+  for (n = 0; n < loads; n++)
+  {
+    if ((status = ModLoadFile(filename, &module)) != MP_OK)
+    {
+      printf("modbench: can't load %s (MPstatus %d)\n", filename, status);
+      exit(1);
+    }
+    ModFree(module);
+  }
+  return((double) (clock() - start) / CLOCKS_PER_SEC);
+}
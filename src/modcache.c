@@ -0,0 +1,287 @@
+/*****************************************************************************/
+/* modcache.c v0.1            Module Cache                                   */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 07:45:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include "modcache.h"
+#include "mpthread.h"
+
+
+/* Each cached module is on two lists: the chain of its hash bucket and    */
+/* the LRU list, which runs from the most recently used (head) to the      */
+/* least (tail).  The cache holds one reference to the module.             */
+struct cache_entry
+{
+  uint64 hash;
+  uint32 size;                     /* file size, part of the key             */
+  const uint8* image;              /* the module's mapped file, to compare   */
+  uint32 bytes;                    /* ModMemoryUsed, as last counted         */
+  MPmodule* module;
+  struct cache_entry* chain;
+  struct cache_entry* prev;
+  struct cache_entry* next;
+};
+
+struct mod_cache
+{
+  MPmutex lock;                    /* everything below is under lock         */
+  uint32 budget;
+  struct cache_entry* bucket[MOD_CACHE_BUCKETS];
+  struct cache_entry* head;
+  struct cache_entry* tail;
+  struct mod_cache_stats stats;
+};
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Local prototypes                                                          */
+static uint64 HashModImage(const uint8* data, uint32 size);
+static struct cache_entry* FindCacheEntry(MPcache* cache, uint64 hash,
+                                          const uint8* data, uint32 size);
+static void UnlinkCacheEntry(MPcache* cache, struct cache_entry* entry);
+static void PushCacheEntry(MPcache* cache, struct cache_entry* entry);
+static void RecountCacheEntries(MPcache* cache);
+static void EvictCacheEntries(MPcache* cache);
+
+
+
+/* A fast 64 bit hash of the whole file, 8 bytes per step (a multiply-     */
+/* rotate mix in the style of MurmurHash).  It is not cryptographic: it    */
+/* only has to spread mod files over the buckets; FindCacheEntry compares  */
+/* the files themselves.                                                   */
+uint64 HashModImage(const uint8* data, uint32 size)
+{
+  const uint64 k1 = 0x87C37B91114253D5ULL, k2 = 0x4CF5AD432745937FULL;
+  uint64 h = size, w;
+  uint32 n;
+
+  for (n = 0; n + 8 <= size; n += 8)
+  {
+    memcpy(&w, data + n, 8);       /* the image need not be aligned         */
+    w *= k1;
+    h ^= ROTL64(w, 31) * k2;
+    h = ROTL64(h, 27) * 5 + 0x52DCE729;
+  }
+  for (w = 0; n < size; n++)
+    w = (w << 8) | data[n];
+  h ^= ROTL64(w * k1, 31) * k2;
+
+  /* Make every input bit affect every output bit                      */
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return(h);
+}
+
+
+
+/* The entry for the file data, or NULL.  Equal hashes and sizes are only  */
+/* taken as the same file once the bytes agree too, so a collision is a    */
+/* miss rather than the wrong song.  A module the cache holds keeps its    */
+/* mapping, so entry->image is good for as long as the entry is.           */
+struct cache_entry* FindCacheEntry(MPcache* cache, uint64 hash,
+                                   const uint8* data, uint32 size)
+{
+  struct cache_entry* entry;
+
+  for (entry = cache->bucket[hash & (MOD_CACHE_BUCKETS - 1)]; entry;
+       entry = entry->chain)
+    if ((entry->hash == hash) && (entry->size == size) &&
+        !memcmp(entry->image, data, size))
+      return(entry);
+  return(NULL);
+}
+
+
+
+/* Takes entry off the LRU list (it stays in its bucket)                  */
+void UnlinkCacheEntry(MPcache* cache, struct cache_entry* entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    cache->head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    cache->tail = entry->prev;
+}
+
+
+
+/* Puts entry at the head of the LRU list                                 */
+void PushCacheEntry(MPcache* cache, struct cache_entry* entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head)
+    cache->head->prev = entry;
+  else
+    cache->tail = entry;
+  cache->head = entry;
+}
+
+
+
+/* A cached module grows after it is inserted when ModPrepareSamples or   */
+/* a lazy ModGetSample is used on it, so the sizes are counted again      */
+/* before they are relied on                                              */
+void RecountCacheEntries(MPcache* cache)
+{
+  struct cache_entry* entry;
+
+  for (entry = cache->head; entry; entry = entry->next)
+  {
+    cache->stats.bytes_used -= entry->bytes;
+    entry->bytes = ModMemoryUsed(entry->module);
+    cache->stats.bytes_used += entry->bytes;
+  }
+}
+
+
+
+/* Drops least recently used modules until the cache is within budget    */
+void EvictCacheEntries(MPcache* cache)
+{
+  struct cache_entry* entry;
+  struct cache_entry** link;
+
+  RecountCacheEntries(cache);
+  while (cache->tail && (cache->stats.bytes_used > cache->budget))
+  {
+    entry = cache->tail;
+    UnlinkCacheEntry(cache, entry);
+    for (link = &cache->bucket[entry->hash & (MOD_CACHE_BUCKETS - 1)];
+         *link != entry; link = &(*link)->chain)
+      ;
+    *link = entry->chain;
+
+    cache->stats.bytes_used -= entry->bytes;
+    cache->stats.number_modules--;
+    cache->stats.evictions++;
+    ModFree(entry->module);
+    free(entry);
+  }
+}
+
+
+
+MPstatus ModCacheCreate(uint32 byte_budget, MPcache** ret_cache)
+{
+  MPstatus status;
+
+  if (!(*ret_cache = (MPcache*) calloc(1, sizeof(MPcache))))
+    return(MP_NOMEM);
+  if ((status = MutexInit(&(*ret_cache)->lock)) != MP_OK)
+  {
+    free(*ret_cache);
+    return(status);
+  }
+  (*ret_cache)->budget = byte_budget;
+  return(MP_OK);
+}
+
+
+
+/* Gives back the cache's references.  Modules handed out stay good until  */
+/* they are ModFreed.                                                      */
+void ModCacheDestroy(MPcache* cache)
+{
+  if (!cache)
+    return;
+  cache->budget = 0;
+  EvictCacheEntries(cache);
+  MutexDestroy(&cache->lock);
+  free(cache);
+}
+
+
+
+/* The file is mapped and hashed.  On a hit the mapping is dropped and the */
+/* cached module shared; on a miss the module is built over the mapping    */
+/* and added to the cache.  Loading is done outside the lock, so if two    */
+/* threads miss on the same song at once, the one that finishes second     */
+/* uses the module of the first.                                           */
+MPstatus ModCacheLoadFile(MPcache* cache, const char* songname,
+                          MPmodule** ret_module)
+{
+  struct cache_entry* entry;
+  struct cache_entry* found;
+  const uint8* data;
+  uint32 size;
+  uint64 hash;
+  MPmodule* module;
+  MPstatus status;
+
+  if ((status = MapSong(songname, &data, &size)) != MP_OK)
+    return(status);
+  hash = HashModImage(data, size);
+
+  MutexLock(&cache->lock);
+  if ((entry = FindCacheEntry(cache, hash, data, size)))
+  {
+    UnlinkCacheEntry(cache, entry);
+    PushCacheEntry(cache, entry);
+    cache->stats.hits++;
+    *ret_module = ModShare(entry->module);
+    EvictCacheEntries(cache);
+    MutexUnlock(&cache->lock);
+    UnmapSong(data, size);
+    return(MP_OK);
+  }
+  cache->stats.misses++;
+  MutexUnlock(&cache->lock);
+
+  if ((status = ModLoadMapped(data, size, &module)) != MP_OK)
+    return(status);
+  if (!(entry = (struct cache_entry*) malloc(sizeof(struct cache_entry))))
+  {
+    /* The module is still good, it just won't be cached                 */
+    *ret_module = module;
+    return(MP_OK);
+  }
+  entry->hash = hash;
+  entry->size = size;
+  entry->image = data;
+  entry->bytes = ModMemoryUsed(module);
+
+  MutexLock(&cache->lock);
+  if ((found = FindCacheEntry(cache, hash, data, size)))
+  {
+    free(entry);
+    ModFree(module);
+    entry = found;
+  }
+  else
+  {
+    entry->module = module;
+    entry->chain = cache->bucket[hash & (MOD_CACHE_BUCKETS - 1)];
+    cache->bucket[hash & (MOD_CACHE_BUCKETS - 1)] = entry;
+    PushCacheEntry(cache, entry);
+    cache->stats.bytes_used += entry->bytes;
+    cache->stats.number_modules++;
+  }
+  *ret_module = ModShare(entry->module);
+  EvictCacheEntries(cache);
+  MutexUnlock(&cache->lock);
+  return(MP_OK);
+}
+
+
+
+void ModCacheGetStats(MPcache* cache, struct mod_cache_stats* ret_stats)
+{
+  MutexLock(&cache->lock);
+  RecountCacheEntries(cache);
+  *ret_stats = cache->stats;
+  MutexUnlock(&cache->lock);
+}
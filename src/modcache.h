@@ -0,0 +1,47 @@
+/*****************************************************************************/
+/* modcache.h v0.1          Module Cache Declarations                        */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 07:45:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#ifndef modcache_h
+#define modcache_h
+
+#include "loadmod.h"
+
+
+/* A cache of loaded modules, keyed by the file contents (so the same song  */
+/* under two names, or a renamed one, is still a hit).  The modules it      */
+/* hands out are ordinary shared MPmodules: treat them as read-only         */
+/* (ModPrepareSamples is safe on them) and ModFree each one when done.      */
+/* Once the modules held add up to more than the byte budget (see           */
+/* ModMemoryUsed) the least recently used are dropped from the cache;       */
+/* players still using them are not affected.                               */
+/* All the functions may be called from any number of threads at once.     */
+typedef struct mod_cache MPcache;
+
+struct mod_cache_stats
+{
+  uint64 hits;
+  uint64 misses;
+  uint64 evictions;
+  uint32 number_modules;           /* in the cache right now                 */
+  uint32 bytes_used;               /* by those modules                       */
+};
+
+#define MOD_CACHE_BUCKETS 1024     /* hash table size, a power of two        */
+
+MPstatus ModCacheCreate(uint32 byte_budget, MPcache** ret_cache);
+void     ModCacheDestroy(MPcache* cache);
+MPstatus ModCacheLoadFile(MPcache* cache, const char* filename,
+                          MPmodule** ret_module);
+void     ModCacheGetStats(MPcache* cache, struct mod_cache_stats* ret_stats);
+
+#endif
+
+
+
@@ -0,0 +1,307 @@
+/*****************************************************************************/
+/* modindex.c v0.1            Mod Library Index                              */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 07:10:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "modindex.h"
+#include "loadmod.h"
+#include "mpthread.h"
+#ifdef PLAT_LINUX
+#include <dirent.h>
+#include <sys/stat.h>
+#define PATH_SEPARATOR '/'
+#else
+#include <windows.h>
+#define PATH_SEPARATOR '\\'
+#endif
+
+#define INDEX_ENTRY_SIZE 36        /* bytes per entry in the index file,     */
+                                   /* not counting the path                  */
+
+/* What is kept of each file from the directory scan until the index is     */
+/* written.  The fields after status are only good if status is MP_OK.      */
+struct index_entry
+{
+  char* path;                      /* malloced, dirname included             */
+  MPstatus status;
+  char title[MOD_TITLE_NAME_SIZE];
+  char description[MOD_DESC_SIZE];
+  uint32 file_size;
+  uint32 sample_bytes;
+  uint8 number_channels;
+  uint8 length;
+  uint8 number_patterns;
+  uint8 number_samples;
+};
+
+struct index_scan
+{
+  struct index_entry* entry;
+  uint32 number_entries;
+  uint32 max_entries;
+  long next;                       /* entries handed to the probe threads    */
+};
+
+/* Local prototypes                                                          */
+static char* JoinIndexPath(const char* dirname, const char* name);
+static MPstatus AddIndexPath(struct index_scan* scan, char* path, int is_dir);
+static MPstatus ScanIndexDirectory(struct index_scan* scan,
+                                   const char* dirname);
+static int CompareIndexEntries(const void* a, const void* b);
+static void ProbeIndexEntries(void* scan);
+static void PutIndexWord(uint8* buf, uint32 word, int size);
+static MPstatus WriteIndex(struct index_scan* scan, const char* indexname,
+                           size_t prefix, uint32* ret_indexed);
+
+
+
+/* Gives back dirname/name in malloced memory, or NULL                     */
+char* JoinIndexPath(const char* dirname, const char* name)
+{
+  char* path;
+
+  if ((path = (char*) malloc(strlen(dirname) + strlen(name) + 2)))
+    sprintf(path, "%s%c%s", dirname, PATH_SEPARATOR, name);
+  return(path);
+}
+
+
+
+/* Adds path (from JoinIndexPath) to the scan: a file is added as an       */
+/* entry, which keeps path, and a directory is scanned in turn.            */
+/* Directories that can't be read are passed over.                         */
+MPstatus AddIndexPath(struct index_scan* scan, char* path, int is_dir)
+{
+  struct index_entry* entry;
+  MPstatus status;
+
+  if (is_dir)
+  {
+    status = ScanIndexDirectory(scan, path);
+    free(path);
+    return((status == MP_NOMEM) ? MP_NOMEM : MP_OK);
+  }
+
+  if (scan->number_entries == scan->max_entries)
+  {
+    scan->max_entries = scan->max_entries ? scan->max_entries * 2 : 256;
+    if (!(entry = (struct index_entry*) realloc(scan->entry,
+                        scan->max_entries * sizeof(struct index_entry))))
+    {
+      free(path);
+      return(MP_NOMEM);
+    }
+    scan->entry = entry;
+  }
+  scan->entry[scan->number_entries++].path = path;
+  return(MP_OK);
+}
+
+
+
+/* Adds every file under dirname to the scan                              */
+MPstatus ScanIndexDirectory(struct index_scan* scan, const char* dirname)
+{
+  MPstatus status = MP_OK;
+#ifdef PLAT_LINUX
+  DIR* dir;
+  struct dirent* de;
+  struct stat st;
+  char* path;
+
+  if (!(dir = opendir(dirname)))
+    return(MP_BADFILE);
+  while ((status == MP_OK) && (de = readdir(dir)))
+  {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+      continue;
+    /* d_type is not always filled in, so ask stat what the name is      */
+    if (!(path = JoinIndexPath(dirname, de->d_name)))
+      status = MP_NOMEM;
+    else if (!stat(path, &st) && (S_ISDIR(st.st_mode) ||
+                                  S_ISREG(st.st_mode)))
+      status = AddIndexPath(scan, path, S_ISDIR(st.st_mode));
+    else
+      free(path);
+  }
+  closedir(dir);
+#else
+  WIN32_FIND_DATAA fd;
+  HANDLE find;
+  char* path;
+
+  if (!(path = JoinIndexPath(dirname, "*")))
+    return(MP_NOMEM);
+  find = FindFirstFileA(path, &fd);
+  free(path);
+  if (find == INVALID_HANDLE_VALUE)
+    return(MP_BADFILE);
+  do
+  {
+    if (!strcmp(fd.cFileName, ".") || !strcmp(fd.cFileName, ".."))
+      continue;
+    if (!(path = JoinIndexPath(dirname, fd.cFileName)))
+      status = MP_NOMEM;
+    else
+      status = AddIndexPath(scan, path,
+                     (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+  }
+  while ((status == MP_OK) && FindNextFileA(find, &fd));
+  FindClose(find);
+#endif
+  return(status);
+}
+
+
+
+int CompareIndexEntries(const void* a, const void* b)
+{
+  return(strcmp(((const struct index_entry*) a)->path,
+                ((const struct index_entry*) b)->path));
+}
+
+
+
+/* The probe threads.  Each takes the next entry nobody has taken yet     */
+/* until there are none left, so slow files don't hold the others up.    */
+void ProbeIndexEntries(void* arg)
+{
+  struct index_scan* scan = (struct index_scan*) arg;
+  struct index_entry* entry;
+  struct mod_info info;
+  long n;
+
+  while ((n = ATOMICINC(scan->next)) <= (long) scan->number_entries)
+  {
+    entry = &scan->entry[n - 1];
+    if ((entry->status = ModProbeFile(entry->path, &info)) != MP_OK)
+      continue;
+    memcpy(entry->title, info.title, MOD_TITLE_NAME_SIZE);
+    memcpy(entry->description, info.description, MOD_DESC_SIZE);
+    entry->file_size = info.file_size;
+    entry->sample_bytes = info.sample_bytes;
+    entry->number_channels = info.number_channels;
+    entry->length = info.length;
+    entry->number_patterns = info.number_patterns;
+    entry->number_samples = info.number_samples;
+  }
+}
+
+
+
+/* Stores the low size bytes of word at buf, little-endian                */
+void PutIndexWord(uint8* buf, uint32 word, int size)
+{
+  while (size--)
+  {
+    *buf++ = (uint8) word;
+    word >>= 8;
+  }
+}
+
+
+
+/* Writes the entries that probed MP_OK in the format given in modindex.h */
+/* prefix is the length of the part of each path that is left out.  If    */
+/* any write fails (a full disk, say) the partial file is removed, so a   */
+/* truncated index is never left looking like a good one.                 */
+MPstatus WriteIndex(struct index_scan* scan, const char* indexname,
+                    size_t prefix, uint32* ret_indexed)
+{
+  FILE* fd;
+  uint8 buf[INDEX_ENTRY_SIZE];
+  struct index_entry* entry;
+  size_t len;
+  uint32 n, count = 0;
+  int ok;
+
+  for (n = 0; n < scan->number_entries; n++)
+    if (scan->entry[n].status == MP_OK)
+      count++;
+
+  if (!(fd = fopen(indexname, "wb")))
+    return(MP_BADFILE);
+  memcpy(buf, MOD_INDEX_MAGIC, 4);
+  PutIndexWord(buf + 4, count, 4);
+  ok = (fwrite(buf, 1, 8, fd) == 8);
+
+  for (n = 0; ok && (n < scan->number_entries); n++)
+  {
+    entry = &scan->entry[n];
+    if (entry->status != MP_OK)
+      continue;
+    len = strlen(entry->path + prefix);
+    PutIndexWord(buf, (uint32) len, 2);
+    ok = (fwrite(buf, 1, 2, fd) == 2) &&
+         (fwrite(entry->path + prefix, 1, len, fd) == len);
+
+    PutIndexWord(buf, entry->file_size, 4);
+    PutIndexWord(buf + 4, entry->sample_bytes, 4);
+    memcpy(buf + 8, entry->title, MOD_TITLE_NAME_SIZE);
+    memcpy(buf + 8 + MOD_TITLE_NAME_SIZE, entry->description, MOD_DESC_SIZE);
+    buf[32] = entry->number_channels;
+    buf[33] = entry->length;
+    buf[34] = entry->number_patterns;
+    buf[35] = entry->number_samples;
+    ok = ok && (fwrite(buf, 1, INDEX_ENTRY_SIZE, fd) == INDEX_ENTRY_SIZE);
+  }
+
+  /* fclose flushes, so it can be the write that finds the disk full     */
+  if (fclose(fd) || !ok)
+  {
+    remove(indexname);
+    return(MP_BADFILE);
+  }
+  *ret_indexed = count;
+  return(MP_OK);
+}
+
+
+
+/* The whole directory is listed first, then probed by num_threads        */
+/* threads (the calling one included), then the index is written.  Only  */
+/* MOD_HEADER_SIZE bytes of each file are read.                           */
+MPstatus ModIndexDirectory(const char* dirname, const char* indexname,
+                           int num_threads, uint32* ret_indexed,
+                           uint32* ret_skipped)
+{
+  struct index_scan scan;
+  MPthread thread[MOD_INDEX_MAX_THREADS];
+  MPstatus status;
+  uint32 n;
+  int started;
+
+  memset(&scan, 0, sizeof(scan));
+  if ((status = ScanIndexDirectory(&scan, dirname)) == MP_OK)
+  {
+    qsort(scan.entry, scan.number_entries, sizeof(struct index_entry),
+          CompareIndexEntries);
+
+    if (num_threads > MOD_INDEX_MAX_THREADS)
+      num_threads = MOD_INDEX_MAX_THREADS;
+    /* If a thread won't start, the ones that did just do more of the work */
+    for (started = 0; started < num_threads - 1; started++)
+      if (ThreadStart(&thread[started], ProbeIndexEntries, &scan) != MP_OK)
+        break;
+    ProbeIndexEntries(&scan);
+    while (started--)
+      ThreadJoin(thread[started]);
+
+    if ((status = WriteIndex(&scan, indexname, strlen(dirname) + 1,
+                             ret_indexed)) == MP_OK)
+      *ret_skipped = scan.number_entries - *ret_indexed;
+  }
+
+  for (n = 0; n < scan.number_entries; n++)
+    free(scan.entry[n].path);
+  free(scan.entry);
+  return(status);
+}
@@ -0,0 +1,40 @@
+/*****************************************************************************/
+/* modindex.h v0.1          Mod Library Index Declarations                   */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 07:10:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#ifndef modindex_h
+#define modindex_h
+
+#include "mod.h"
+
+
+/* ModIndexDirectory probes (see ModProbe) every file under dirname,        */
+/* sub-directories included, using num_threads threads, and writes what it  */
+/* finds about the ones that are mods to the file indexname.  Files that    */
+/* are not mods, or would not load, are left out and counted in skipped.    */
+/* MP_BADFILE if the index can't be written in full; no file is left then.  */
+/*                                                                          */
+/* The index file is little-endian throughout:                              */
+/*   "MPIX", uint32 number of entries                                       */
+/* then for each mod, in file name order:                                   */
+/*   uint16 path length, the path (relative to dirname, no '\0')            */
+/*   uint32 file size, uint32 sample bytes                                  */
+/*   title (MOD_TITLE_NAME_SIZE), description (MOD_DESC_SIZE)               */
+/*   uint8 channels, length, reachable patterns, samples used               */
+#define MOD_INDEX_MAGIC "MPIX"
+#define MOD_INDEX_MAX_THREADS 64
+
+MPstatus ModIndexDirectory(const char* dirname, const char* indexname,
+                           int num_threads, uint32* ret_indexed,
+                           uint32* ret_skipped);
+
+#endif
+
+
+
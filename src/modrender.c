@@ -0,0 +1,474 @@
+/*****************************************************************************/
+/* modrender.c v0.1           Render Benchmark                               */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 11:20:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments: A program of its own, not part of the player.  See README.md.   */
+/*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mod.h"
+#include "loadmod.h"
+#include "mixer.h"
+#include "ptplay.h"
+
+#define RENDER_DEFAULT_RATE 44100
+#define RENDER_PAULA_RATE 48000    /* -p: Paula mode at 48 kHz ...          */
+#define RENDER_PAULA_CHANNELS 8    /* ... with 8 channels                   */
+#define RENDER_KERNELS 6           /* -k: the MOD_INTERP_*, then Paula+A500 */
+
+/* What one run of a song through the player took                            */
+struct render_run
+{
+  double seconds;                  /* of CPU time                            */
+  double voice_samples;            /* made for all the channels together     */
+  double out_samples;              /* voice_samples / number_channels        */
+};
+
+/* The stems of one run in -c mode, a hash of each channel's output          */
+struct render_stems
+{
+  uint64 hash[MOD_MAX_CHANNELS];
+};
+
+static MPstatus LoadImage(const char* filename, uint8** ret_data,
+                          uint32* ret_size);
+static MPstatus WidenMod(const uint8* data, uint32 size, int channels,
+                         uint8** ret_data, uint32* ret_size);
+static MPstatus RenderSong(const MPmodule* module, int rate, int kernel,
+                           int filter, struct render_stems* stems,
+                           struct render_run* ret_run);
+static int NullSink(void* sink_data, int channel_id, void** samples,
+                    int length);
+static int StemSink(void* sink_data, int channel_id, void** samples,
+                    int length);
+static void PrintRun(const char* name, const struct render_run* run,
+                     int rate);
+static void AddRun(struct render_run* total, const struct render_run* run);
+static int BenchSongs(int argc, char** argv, int first, int rate);
+static int BenchKernels(int argc, char** argv, int first, int rate);
+static int BenchChannels(int argc, char** argv, int first, int rate);
+static int BenchPaula(int argc, char** argv, int first);
+
+static const char* kernel_name[RENDER_KERNELS] =
+  { "nearest", "linear", "cubic", "sinc", "paula", "paula+A500" };
+
+
+
+/* modrender [-r rate] [-k | -c | -p] file.mod ...                           */
+/* Plays each file once through (to its end or its first loop) with a sink   */
+/* that throws the output away, and prints how long that took.  With no      */
+/* mode it is each file with the default (nearest) player; -k is every       */
+/* kernel over all the files, -c is the files widened to 4, 16 and 32        */
+/* channels (checking that every channel plays what it should) and -p is     */
+/* Paula mode with the A500 filter at 48 kHz on the files widened to 8       */
+/* channels.  The exit status is 1 if anything failed.                       */
+int main(int argc, char** argv)
+{
+  int rate = RENDER_DEFAULT_RATE, first = 1;
+  char mode = 0;
+
+  while ((first < argc) && (argv[first][0] == '-'))
+  {
+    if (!strcmp(argv[first], "-r") && (first + 1 < argc))
+    {
+      rate = atoi(argv[first + 1]);
+      first += 2;
+    }
+    else if (!mode &&
+             (!strcmp(argv[first], "-k") || !strcmp(argv[first], "-c") ||
+              !strcmp(argv[first], "-p")))
+      mode = argv[first++][1];
+    else
+      break;
+  }
+  if ((rate <= 0) || (first >= argc) || (argv[first][0] == '-'))
+  {
+    printf("usage: modrender [-r rate] [-k | -c | -p] file.mod ...\n");
+    return(1);
+  }
+
+  switch (mode)
+  {
+  case 'k':
+    return(BenchKernels(argc, argv, first, rate));
+  case 'c':
+    return(BenchChannels(argc, argv, first, rate));
+  case 'p':
+    return(BenchPaula(argc, argv, first));
+  }
+  return(BenchSongs(argc, argv, first, rate));
+}
+
+
+
+/* Each file at rate with the default player, then all of them together      */
+int BenchSongs(int argc, char** argv, int first, int rate)
+{
+  struct render_run run, total;
+  MPmodule* module;
+  MPstatus status;
+  int n;
+
+  memset(&total, 0, sizeof(total));
+  printf("%-32s %10s %10s %10s %10s\n", "file", "samples", "ms",
+         "Msample/s", "x realtime");
+  for (n = first; n < argc; n++)
+  {
+    if (((status = ModLoadFile(argv[n], &module)) != MP_OK) ||
+        ((status = RenderSong(module, rate, MOD_INTERP_NEAREST,
+                              MOD_FILTER_NONE, NULL, &run)) != MP_OK))
+    {
+      printf("modrender: can't play %s (MPstatus %d)\n", argv[n], status);
+      return(1);
+    }
+    ModFree(module);
+    PrintRun(argv[n], &run, rate);
+    AddRun(&total, &run);
+  }
+  PrintRun("all", &total, rate);
+  return(0);
+}
+
+
+
+/* All the files with each kernel in turn.  The cost of a kernel is given    */
+/* per voice (channel) per output sample, as that is what it is run for.     */
+int BenchKernels(int argc, char** argv, int first, int rate)
+{
+  struct render_run run, total;
+  MPmodule* module;
+  MPstatus status;
+  int k, n;
+
+  printf("%-12s %10s %10s %16s\n", "kernel", "samples", "x realtime",
+         "ns/voice/sample");
+  for (k = 0; k < RENDER_KERNELS; k++)
+  {
+    memset(&total, 0, sizeof(total));
+    for (n = first; n < argc; n++)
+    {
+      if (((status = ModLoadFile(argv[n], &module)) != MP_OK) ||
+          ((status = ModPrepareSamples(module, MOD_PREP_INT16)) != MP_OK) ||
+          ((status = RenderSong(module, rate,
+                                (k < MOD_INTERP_KERNELS) ? k :
+                                MOD_INTERP_PAULA,
+                                (k < MOD_INTERP_KERNELS) ? MOD_FILTER_NONE :
+                                MOD_FILTER_A500, NULL, &run)) != MP_OK))
+      {
+        printf("modrender: can't play %s (MPstatus %d)\n", argv[n], status);
+        return(1);
+      }
+      ModFree(module);
+      AddRun(&total, &run);
+    }
+    printf("%-12s %10.0f %10.1f %16.2f\n", kernel_name[k], total.out_samples,
+           total.out_samples / rate / total.seconds,
+           total.seconds * 1e9 / total.voice_samples);
+  }
+  return(0);
+}
+
+
+
+/* The files widened to 4, 16 and 32 channels, every channel playing the     */
+/* notes of one of the original four.  Before it is timed each widened       */
+/* song is played once with stems to check that it loaded with all its       */
+/* channels and that each one's output is the same as the original           */
+/* channel's, which it must be as the channels don't affect each other.      */
+int BenchChannels(int argc, char** argv, int first, int rate)
+{
+  static const int widths[] = { 4, 16, 32 };
+  struct render_stems stems;
+  struct render_run run, total;
+  MPmodule* module;
+  MPstatus status;
+  uint8* data;
+  uint8* wide;
+  uint32 size, wide_size;
+  int w, n, c, fails = 0;
+
+  printf("%-10s %10s %10s %10s %16s\n", "channels", "samples", "Msample/s",
+         "x realtime", "ns/voice/sample");
+  for (w = 0; w < (int) (sizeof(widths) / sizeof(widths[0])); w++)
+  {
+    memset(&total, 0, sizeof(total));
+    for (n = first; n < argc; n++)
+    {
+      if ((status = LoadImage(argv[n], &data, &size)) != MP_OK)
+      {
+        printf("modrender: can't read %s (MPstatus %d)\n", argv[n], status);
+        return(1);
+      }
+      status = WidenMod(data, size, widths[w], &wide, &wide_size);
+      free(data);
+      if (status == MP_BADARGS)
+        continue;                  /* not a 4 channel mod                    */
+      if ((status != MP_OK) ||
+          ((status = ModLoadMemory(wide, wide_size, &module)) != MP_OK) ||
+          ((status = RenderSong(module, rate, MOD_INTERP_NEAREST,
+                                MOD_FILTER_NONE, &stems, &run)) != MP_OK) ||
+          ((status = RenderSong(module, rate, MOD_INTERP_NEAREST,
+                                MOD_FILTER_NONE, NULL, &run)) != MP_OK))
+      {
+        printf("modrender: can't play %s at %d channels (MPstatus %d)\n",
+               argv[n], widths[w], status);
+        return(1);
+      }
+      if (ModGetData(module)->number_channels != widths[w])
+      {
+        printf("FAIL %s: %d channels loaded, not %d\n", argv[n],
+               ModGetData(module)->number_channels, widths[w]);
+        fails++;
+      }
+      for (c = 4; c < widths[w]; c++)
+        if (stems.hash[c] != stems.hash[c & 3])
+        {
+          printf("FAIL %s at %d channels: channel %d differs from %d\n",
+                 argv[n], widths[w], c, c & 3);
+          fails++;
+          break;
+        }
+      ModFree(module);
+      free(wide);
+      AddRun(&total, &run);
+    }
+    if (total.out_samples > 0)
+      printf("%-10d %10.0f %10.2f %10.1f %16.2f\n", widths[w],
+             total.out_samples, total.out_samples / total.seconds / 1e6,
+             total.out_samples / rate / total.seconds,
+             total.seconds * 1e9 / total.voice_samples);
+  }
+  return(fails ? 1 : 0);
+}
+
+
+
+/* Paula mode through the A500 filters at 48 kHz on the files widened to     */
+/* 8 channels: the case that has to run in real time.  The x realtime is     */
+/* how many seconds of song are played per second of CPU.                    */
+int BenchPaula(int argc, char** argv, int first)
+{
+  struct render_run run, total;
+  MPmodule* module;
+  MPstatus status;
+  uint8* data;
+  uint8* wide;
+  uint32 size, wide_size;
+  int n;
+
+  memset(&total, 0, sizeof(total));
+  printf("Paula mode, A500 filter, %d Hz, %d channels\n", RENDER_PAULA_RATE,
+         RENDER_PAULA_CHANNELS);
+  printf("%-32s %10s %10s %10s %10s\n", "file", "samples", "ms",
+         "Msample/s", "x realtime");
+  for (n = first; n < argc; n++)
+  {
+    if ((status = LoadImage(argv[n], &data, &size)) != MP_OK)
+    {
+      printf("modrender: can't read %s (MPstatus %d)\n", argv[n], status);
+      return(1);
+    }
+    status = WidenMod(data, size, RENDER_PAULA_CHANNELS, &wide, &wide_size);
+    free(data);
+    if (status == MP_BADARGS)
+      continue;
+    if ((status != MP_OK) ||
+        ((status = ModLoadMemory(wide, wide_size, &module)) != MP_OK) ||
+        ((status = RenderSong(module, RENDER_PAULA_RATE, MOD_INTERP_PAULA,
+                              MOD_FILTER_A500, NULL, &run)) != MP_OK))
+    {
+      printf("modrender: can't play %s (MPstatus %d)\n", argv[n], status);
+      return(1);
+    }
+    ModFree(module);
+    free(wide);
+    PrintRun(argv[n], &run, RENDER_PAULA_RATE);
+    AddRun(&total, &run);
+  }
+  PrintRun("all", &total, RENDER_PAULA_RATE);
+  return(0);
+}
+
+
+
+/* Plays module once through at rate with the kernel (and, for Paula mode,   */
+/* the filter).  With stems the output of each channel is hashed into them   */
+/* as well, so that run is slower and shouldn't be timed.                    */
+MPstatus RenderSong(const MPmodule* module, int rate, int kernel,
+                    int filter, struct render_stems* stems,
+                    struct render_run* ret_run)
+{
+  MPplayer* player;
+  MPstatus status;
+  double voice_samples = 0.0;
+  clock_t start;
+  int n;
+
+  if ((status = PlayerCreate(module, rate, &player)) != MP_OK)
+    return(status);
+  if (((status = PlayerSetInterpolation(player, kernel)) != MP_OK) ||
+      ((kernel == MOD_INTERP_PAULA) &&
+       ((status = PlayerSetFilter(player, filter)) != MP_OK)))
+  {
+    PlayerFree(player);
+    return(status);
+  }
+  PlayerSetSink(player, NullSink, &voice_samples);
+  if (stems)
+  {
+    for (n = 0; n < MOD_MAX_CHANNELS; n++)
+      stems->hash[n] = 1469598103934665603ULL;
+    PlayerSetStems(player, StemSink, stems);
+  }
+
+  /* Bad effects are played round, so they are not a failure here         */
+  start = clock();
+  PlayerRun(player);
+  ret_run->seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+  ret_run->voice_samples = voice_samples;
+  ret_run->out_samples = voice_samples / ModGetData(module)->number_channels;
+  PlayerFree(player);
+  return(MP_OK);
+}
+
+
+
+/* Counts what it is given and keeps none of it                              */
+int NullSink(void* sink_data, int channel_id, void** samples, int length)
+{
+  (void) channel_id;
+  (void) samples;
+  *(double*) sink_data += length;
+  return(length);
+}
+
+
+
+/* Hashes (FNV-1a) one channel's tick into its stem.  A tick of silence is   */
+/* hashed as its length, so two channels only agree if they were quiet for   */
+/* the same ticks.  The output is 8 bit, the player's default.               */
+int StemSink(void* sink_data, int channel_id, void** samples, int length)
+{
+  struct render_stems* stems = (struct render_stems*) sink_data;
+  const uint8* s = (const uint8*) *samples;
+  uint64 h;
+  int c, n;
+
+  for (c = 0; (c < MOD_MAX_CHANNELS) && (MixerGetChanID(c) != channel_id);
+       c++)
+    ;
+  if (c == MOD_MAX_CHANNELS)
+    return(length);
+  h = stems->hash[c];
+  if (!s)
+    h = (h ^ (uint64) length) * 1099511628211ULL;
+  else
+    for (n = 0; n < length; n++)
+      h = (h ^ s[n]) * 1099511628211ULL;
+  stems->hash[c] = h;
+  return(length);
+}
+
+
+
+/* A whole file in a malloced buffer                                         */
+MPstatus LoadImage(const char* filename, uint8** ret_data, uint32* ret_size)
+{
+  FILE* fd;
+  long size;
+  MPstatus status;
+
+  if ((status = OpenSong(filename, &fd)) != MP_OK)
+    return(status);
+  if (fseek(fd, 0, SEEK_END) || ((size = ftell(fd)) <= 0) ||
+      fseek(fd, 0, SEEK_SET))
+  {
+    fclose(fd);
+    return(MP_BADFILE);
+  }
+  if (!(*ret_data = (uint8*) malloc((size_t) size)))
+  {
+    fclose(fd);
+    return(MP_NOMEM);
+  }
+  if (fread(*ret_data, 1, (size_t) size, fd) != (size_t) size)
+  {
+    free(*ret_data);
+    fclose(fd);
+    return(MP_UNEXPECTED_EOF);
+  }
+  fclose(fd);
+  *ret_size = (uint32) size;
+  return(MP_OK);
+}
+
+
+
+/* Makes a channels channel copy of the 4 channel mod in data: the same      */
+/* header with an xCHN or xxCH tag, each pattern row's cells repeated to     */
+/* fill the wider row (channel c plays what channel c & 3 did), and the      */
+/* same samples.  MP_BADARGS if data isn't a 4 channel mod.                  */
+MPstatus WidenMod(const uint8* data, uint32 size, int channels,
+                  uint8** ret_data, uint32* ret_size)
+{
+  const struct mod_data* mod;
+  MPmodule* module;
+  MPstatus status;
+  uint32 rows, row_size, pattern_size, sample_size, r;
+  int c;
+
+  if ((status = ModLoadMemory(data, size, &module)) != MP_OK)
+    return(status);
+  mod = ModGetData(module);
+  if (mod->number_channels != 4)
+  {
+    ModFree(module);
+    return(MP_BADARGS);
+  }
+  rows = (mod->highest_pattern + 1) * MOD_NUM_DIVISIONS;
+  ModFree(module);
+
+  row_size = 4 * MOD_CELL_SIZE;
+  pattern_size = rows * row_size;
+  sample_size = size - MOD_HEADER_SIZE - pattern_size;
+  *ret_size = MOD_HEADER_SIZE + rows * channels * MOD_CELL_SIZE +
+              sample_size;
+  if (!(*ret_data = (uint8*) malloc(*ret_size)))
+    return(MP_NOMEM);
+
+  memcpy(*ret_data, data, MOD_HEADER_SIZE);
+  sprintf((char*) *ret_data + MOD_HEADER_SIZE - MOD_DESC_SIZE,
+          (channels < 10) ? "%dCHN" : "%dCH", channels);
+  for (r = 0; r < rows; r++)
+    for (c = 0; c < channels; c += 4)
+      memcpy(*ret_data + MOD_HEADER_SIZE +
+             (r * channels + c) * MOD_CELL_SIZE,
+             data + MOD_HEADER_SIZE + r * row_size, row_size);
+  memcpy(*ret_data + MOD_HEADER_SIZE + rows * channels * MOD_CELL_SIZE,
+         data + MOD_HEADER_SIZE + pattern_size, sample_size);
+  return(MP_OK);
+}
+
+
+
+void PrintRun(const char* name, const struct render_run* run, int rate)
+{
+  printf("%-32s %10.0f %10.1f %10.2f %10.1f\n", name, run->out_samples,
+         run->seconds * 1e3, run->out_samples / run->seconds / 1e6,
+         run->out_samples / rate / run->seconds);
+}
+
+
+
+void AddRun(struct render_run* total, const struct render_run* run)
+{
+  total->seconds += run->seconds;
+  total->voice_samples += run->voice_samples;
+  total->out_samples += run->out_samples;
+}
@@ -0,0 +1,124 @@
+/*****************************************************************************/
+/* mpthread.c v0.1            Threads and Locks                              */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 07:10:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments: The little threading the loaders need, for pthreads             */
+/*           (PLAT_LINUX) and Win32                                          */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include "mpthread.h"
+
+
+/* The function and argument handed to ThreadStart.  They are passed to    */
+/* the new thread in malloced memory which the thread frees.               */
+struct thread_start
+{
+  void (*fun)(void*);
+  void* arg;
+};
+
+/* Local prototypes                                                          */
+#ifdef PLAT_LINUX
+static void* ThreadMain(void* start);
+#else
+static DWORD WINAPI ThreadMain(LPVOID start);
+#endif
+
+
+
+#ifdef PLAT_LINUX
+void* ThreadMain(void* start)
+#else
+DWORD WINAPI ThreadMain(LPVOID start)
+#endif
+{
+  struct thread_start st = *(struct thread_start*) start;
+
+  free(start);
+  st.fun(st.arg);
+  return(0);
+}
+
+
+
+MPstatus ThreadStart(MPthread* ret_thread, void (*fun)(void*), void* arg)
+{
+  struct thread_start* start;
+
+  if (!(start = (struct thread_start*) malloc(sizeof(struct thread_start))))
+    return(MP_NOMEM);
+  start->fun = fun;
+  start->arg = arg;
+#ifdef PLAT_LINUX
+  if (pthread_create(ret_thread, NULL, ThreadMain, start))
+#else
+  if (!(*ret_thread = CreateThread(NULL, 0, ThreadMain, start, 0, NULL)))
+#endif
+  {
+    free(start);
+    return(MP_NOTHREAD);
+  }
+  return(MP_OK);
+}
+
+
+
+void ThreadJoin(MPthread thread)
+{
+#ifdef PLAT_LINUX
+  pthread_join(thread, NULL);
+#else
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#endif
+}
+
+
+
+MPstatus MutexInit(MPmutex* mutex)
+{
+#ifdef PLAT_LINUX
+  if (pthread_mutex_init(mutex, NULL))
+    return(MP_NOMEM);
+#else
+  InitializeCriticalSection(mutex);
+#endif
+  return(MP_OK);
+}
+
+
+
+void MutexLock(MPmutex* mutex)
+{
+#ifdef PLAT_LINUX
+  pthread_mutex_lock(mutex);
+#else
+  EnterCriticalSection(mutex);
+#endif
+}
+
+
+
+void MutexUnlock(MPmutex* mutex)
+{
+#ifdef PLAT_LINUX
+  pthread_mutex_unlock(mutex);
+#else
+  LeaveCriticalSection(mutex);
+#endif
+}
+
+
+
+void MutexDestroy(MPmutex* mutex)
+{
+#ifdef PLAT_LINUX
+  pthread_mutex_destroy(mutex);
+#else
+  DeleteCriticalSection(mutex);
+#endif
+}
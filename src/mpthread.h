@@ -0,0 +1,56 @@
+/*****************************************************************************/
+/* mpthread.h v0.1          Thread and Lock Declarations                     */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 07:10:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments: The little threading the loaders need, for pthreads             */
+/*           (PLAT_LINUX) and Win32                                          */
+/*****************************************************************************/
+
+#ifndef mpthread_h
+#define mpthread_h
+
+#include "mod.h"
+#ifdef PLAT_LINUX
+#include <pthread.h>
+#else
+#include <windows.h>
+#endif
+
+
+#ifdef PLAT_LINUX
+typedef pthread_t MPthread;
+typedef pthread_mutex_t MPmutex;
+#else
+typedef HANDLE MPthread;
+typedef CRITICAL_SECTION MPmutex;
+#endif
+
+/* Atomic add/subtract of one on a long.  Both give back the new value.     */
+/* ATOMICGET reads one with the same ordering as the others.               */
+#ifdef PLAT_LINUX
+#define ATOMICINC(r) __sync_add_and_fetch(&(r), 1)
+#define ATOMICDEC(r) __sync_sub_and_fetch(&(r), 1)
+#define ATOMICGET(r) __sync_add_and_fetch(&(r), 0)
+#else
+#define ATOMICINC(r) InterlockedIncrement(&(r))
+#define ATOMICDEC(r) InterlockedDecrement(&(r))
+#define ATOMICGET(r) InterlockedCompareExchange(&(r), 0, 0)
+#endif
+
+
+/* fun(arg) is run in a new thread.  Every started thread must be joined.   */
+MPstatus ThreadStart(MPthread* ret_thread, void (*fun)(void*), void* arg);
+void     ThreadJoin(MPthread thread);
+
+MPstatus MutexInit(MPmutex* mutex);
+void     MutexLock(MPmutex* mutex);
+void     MutexUnlock(MPmutex* mutex);
+void     MutexDestroy(MPmutex* mutex);
+
+#endif
+
+
+
@@ -0,0 +1,225 @@
+/*****************************************************************************/
+/* ptflow.c v0.1            Protracker (MOD) Song Flow                       */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 16:20:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ptflow.h"
+#include "ptplay.h"
+
+#define FLOW_NOT_PLAYED 0xFFFFFFFFUL
+#define FLOW_TEMPOS 16             /* room for this many tempos to start with*/
+
+/* Local prototypes */
+static MPstatus AddFlowRow(struct mod_flow* flow, uint32* max_rows,
+                           uint32 sample, uint8 song_pos, uint8 division);
+static MPstatus AddFlowTempo(struct mod_flow* flow, uint32* max_tempos,
+                             uint32 sample, uint8 song_pos, uint8 division,
+                             uint8 speed, uint8 tempo);
+
+
+
+MPstatus AddFlowRow(struct mod_flow* flow, uint32* max_rows,
+                    uint32 sample, uint8 song_pos, uint8 division)
+{
+  struct mod_flow_row* r;
+
+  if (flow->number_rows == *max_rows)
+  {
+    if (!(r = (struct mod_flow_row*) realloc(flow->row,
+          (*max_rows << 1) * sizeof(struct mod_flow_row))))
+      return(MP_NOMEM);
+    flow->row = r;
+    *max_rows <<= 1;
+  }
+  r = &flow->row[flow->number_rows++];
+  r->sample = sample;
+  r->song_pos = song_pos;
+  r->division = division;
+  return(MP_OK);
+}
+
+
+
+MPstatus AddFlowTempo(struct mod_flow* flow, uint32* max_tempos,
+                      uint32 sample, uint8 song_pos, uint8 division,
+                      uint8 speed, uint8 tempo)
+{
+  struct mod_flow_tempo* t;
+
+  if (flow->number_tempos == *max_tempos)
+  {
+    if (!(t = (struct mod_flow_tempo*) realloc(flow->tempo,
+          (*max_tempos << 1) * sizeof(struct mod_flow_tempo))))
+      return(MP_NOMEM);
+    flow->tempo = t;
+    *max_tempos <<= 1;
+  }
+  t = &flow->tempo[flow->number_tempos++];
+  t->sample = sample;
+  t->song_pos = song_pos;
+  t->division = division;
+  t->speed = speed;
+  t->tempo = tempo;
+  return(MP_OK);
+}
+
+
+
+/* Works out the flow of mod at rate.  Apart from the rows a pattern loop    */
+/* goes round again, a row is only ever played once before the song loops,   */
+/* so the order list's worth of rows is allocated to start with.  A song of  */
+/* length 0 plays nothing, so its flow is empty: no rows and no tempos.      */
+MPstatus ModFlow(const struct mod_data* mod, uint32 rate,
+                 struct mod_flow* ret_flow)
+{
+  const struct mod_row* row;
+  struct mod_loop loop;
+  uint32* first;
+  uint32 n, sample = 0, max_tempos = FLOW_TEMPOS;
+  uint32 num_rows = mod->length * MOD_NUM_DIVISIONS, max_rows = num_rows;
+  uint32 tick_size = MODTICKSIZE(rate, MOD_DEFAULT_TEMPO);
+  uint8 speed = MOD_DEFAULT_SPEED, tempo = MOD_DEFAULT_TEMPO;
+  uint8 song_pos = 0, division = 0, last;
+
+  memset(ret_flow, 0, sizeof(struct mod_flow));
+  ret_flow->rate = rate;
+  if (!num_rows)
+    return(MP_OK);
+  loop.row = loop.left = 0;
+  if (!(first = (uint32*) malloc(num_rows * sizeof(uint32))) ||
+      !(ret_flow->row = (struct mod_flow_row*)
+        malloc(max_rows * sizeof(struct mod_flow_row))) ||
+      !(ret_flow->tempo = (struct mod_flow_tempo*)
+        malloc(max_tempos * sizeof(struct mod_flow_tempo))))
+  {
+    free(first);
+    ModFlowFree(ret_flow);
+    return(MP_NOMEM);
+  }
+  for (n = 0; n < num_rows; n++)
+    first[n] = FLOW_NOT_PLAYED;
+  AddFlowTempo(ret_flow, &max_tempos, 0, 0, 0, speed, tempo);
+
+  while (song_pos < mod->length)
+  {
+    n = song_pos * MOD_NUM_DIVISIONS + division;
+    if (first[n] != FLOW_NOT_PLAYED)
+    {
+      ret_flow->loops = 1;
+      ret_flow->loop_pos = song_pos;
+      ret_flow->loop_division = division;
+      ret_flow->loop_sample = first[n];
+      break;
+    }
+    first[n] = sample;
+    row = MODROW(mod, mod->pattern_slot[mod->pattern_table[song_pos]],
+                 division);
+
+    if (((row->flags & MOD_ROW_SPEED) && row->speed != speed) ||
+        ((row->flags & MOD_ROW_TEMPO) && row->tempo != tempo))
+    {
+      if (row->flags & MOD_ROW_SPEED)
+        speed = row->speed;
+      if (row->flags & MOD_ROW_TEMPO)
+        tempo = row->tempo;
+      tick_size = MODTICKSIZE(rate, tempo);
+      if (AddFlowTempo(ret_flow, &max_tempos, sample, song_pos, division,
+                       speed, tempo) != MP_OK)
+      {
+        free(first);
+        ModFlowFree(ret_flow);
+        return(MP_NOMEM);
+      }
+    }
+
+    if (AddFlowRow(ret_flow, &max_rows, sample, song_pos, division) !=
+        MP_OK)
+    {
+      free(first);
+      ModFlowFree(ret_flow);
+      return(MP_NOMEM);
+    }
+    sample += speed * tick_size *
+              (((row->flags & MOD_ROW_DELAY) ? row->delay : 0) + 1);
+
+    /* The rows a pattern loop goes round again don't loop the song          */
+    last = division;
+    if (ModNextRow(row, &song_pos, &division, &loop))
+      for (n = division; n <= last; n++)
+        first[song_pos * MOD_NUM_DIVISIONS + n] = FLOW_NOT_PLAYED;
+  }
+
+  ret_flow->length = sample;
+  free(first);
+  return(MP_OK);
+}
+
+
+
+/* Moves song_pos/division on from row, which has just been played, the      */
+/* way the player does.  A pattern loop (E60 marks its start, E6x goes back  */
+/* x times) is kept in loop, and is taken before any jump or break in the    */
+/* same row.  Returns 1 if it has gone back, so that the rows from division  */
+/* to row are about to be played again.                                      */
+int ModNextRow(const struct mod_row* row, uint8* song_pos, uint8* division,
+               struct mod_loop* loop)
+{
+  uint8 from = *song_pos;
+
+  if (row->flags & MOD_ROW_LOOP)
+  {
+    if (!row->loop)
+      loop->row = *division;
+    else if (!loop->left || --loop->left)
+    {
+      if (!loop->left)
+        loop->left = row->loop;
+      *division = loop->row;
+      return(1);
+    }
+  }
+
+  /* A jump and a break in the same row means "jump_pos at break_row"        */
+  if (row->flags & MOD_ROW_JUMP)
+  {
+    *song_pos = row->jump_pos;
+    *division = (row->flags & MOD_ROW_BREAK) ? row->break_row : 0;
+  }
+  else if (row->flags & MOD_ROW_BREAK)
+  {
+    (*song_pos)++;
+    *division = row->break_row;
+  }
+  else if (++(*division) == MOD_NUM_DIVISIONS)
+  {
+    (*song_pos)++;
+    *division = 0;
+  }
+
+  /* A new pattern starts with no loop                                       */
+  if (*song_pos != from)
+    loop->row = loop->left = 0;
+  return(0);
+}
+
+
+
+void ModFlowFree(struct mod_flow* flow)
+{
+  free(flow->row);
+  free(flow->tempo);
+  flow->row = NULL;
+  flow->tempo = NULL;
+  flow->number_rows = 0;
+  flow->number_tempos = 0;
+}
+
+
+
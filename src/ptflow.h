@@ -0,0 +1,67 @@
+/*****************************************************************************/
+/* ptflow.h v0.1          Protracker (MOD) Song Flow Declarations            */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 16:20:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#ifndef ptflow_h
+#define ptflow_h
+
+#include "mod.h"
+
+
+/* ModFlow follows a song through its order list the way the player does,   */
+/* but looks only at the rows' jumps, breaks, speeds, tempos, pattern loops  */
+/* and delays (see struct mod_row), so no sound is made and no samples are   */
+/* touched.  All times are in output samples at the rate given, and match    */
+/* PlayerRun's output at that rate exactly.                                  */
+
+struct mod_flow_row               /* one for each row played, in order      */
+{
+  uint32 sample;                   /* where the row starts                   */
+  uint8 song_pos, division;
+};
+
+struct mod_flow_tempo             /* one for each change of speed or tempo  */
+{
+  uint32 sample;                   /* from the start of the row it is in     */
+  uint8 song_pos, division;
+  uint8 speed, tempo;              /* ticks per division, beats per minute   */
+};
+
+struct mod_loop                   /* the pattern loop (E6x) going on        */
+{
+  uint8 row;                       /* where it goes back to (set by E60)     */
+  uint8 left;                      /* times still to go back, 0 if none      */
+};
+
+struct mod_flow
+{
+  uint32 rate;
+  uint32 length;                   /* until the song ends or loops           */
+  uint32 number_rows;
+  struct mod_flow_row* row;
+  uint32 number_tempos;            /* the first is the one the song starts   */
+  struct mod_flow_tempo* tempo;    /* with (there are none if length is 0)   */
+
+  int loops;                       /* 0 if the song just ends, else it goes  */
+  uint8 loop_pos, loop_division;   /* back to this row, which it first       */
+  uint32 loop_sample;              /* played at loop_sample                  */
+};
+/* A player left to go round n loops (PlayerSetLoop) plays length +          */
+/* n * (length - loop_sample) samples.                                       */
+
+MPstatus ModFlow(const struct mod_data* mod, uint32 rate,
+                 struct mod_flow* ret_flow);
+void     ModFlowFree(struct mod_flow* flow);
+int      ModNextRow(const struct mod_row* row, uint8* song_pos,
+                    uint8* division, struct mod_loop* loop);
+
+#endif
+
+
+
@@ -0,0 +1,278 @@
+/*****************************************************************************/
+/* ptpaula.c v0.1          Amiga (Paula) Output Emulation                    */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 19:40:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ptpaula.h"
+#include "ptplay.h"
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define PAULA_PI 3.14159265358979323846
+#define BLEP_POINTS (PAULA_BLEP_TAPS * PAULA_BLEP_PHASES)
+#define BLEP_FFT_SIZE (BLEP_POINTS * 4)
+#define BLEP_CUTOFF 0.9             /* of the output rate's Nyquist         */
+
+/* The filters' corners, from the parts on the boards                        */
+#define A500_LP_HZ 4420.97          /* 360 ohm, 0.1 uF                      */
+#define A1200_LP_HZ 34419.32        /* 680 ohm, 6800 pF                     */
+#define AMIGA_HP_HZ 5.20            /* 1390 ohm, 22 uF                      */
+#define LED_HZ 3090.53              /* the Sallen-Key on the LED line       */
+#define LED_Q 0.660
+
+/* The filters run on the level plus this, so that in silence their state   */
+/* settles on it rather than decaying into denormals.  The high pass takes   */
+/* it out again.                                                             */
+#define FILTER_BIAS 1.0f
+
+/* Local prototypes */
+static void BlepFft(double* re, double* im, int n, int inverse);
+static float OnePole(double hz, uint32 rate);
+
+
+
+/* An in-place radix 2 FFT of n (a power of 2) points.  The inverse is       */
+/* scaled by 1 / n.                                                          */
+void BlepFft(double* re, double* im, int n, int inverse)
+{
+  double a, c, s, t_re, t_im;
+  int i, j, k, len;
+
+  for (i = 1, j = 0; i < n; i++)
+  {
+    for (k = n >> 1; j & k; k >>= 1)
+      j ^= k;
+    j ^= k;
+    if (i < j)
+    {
+      t_re = re[i]; re[i] = re[j]; re[j] = t_re;
+      t_im = im[i]; im[i] = im[j]; im[j] = t_im;
+    }
+  }
+
+  for (len = 2; len <= n; len <<= 1)
+  {
+    a = (inverse ? 2.0 : -2.0) * PAULA_PI / len;
+    for (k = 0; k < len / 2; k++)
+    {
+      c = cos(a * k);
+      s = sin(a * k);
+      for (i = k; i < n; i += len)
+      {
+        j = i + len / 2;
+        t_re = re[j] * c - im[j] * s;
+        t_im = re[j] * s + im[j] * c;
+        re[j] = re[i] - t_re;
+        im[j] = im[i] - t_im;
+        re[i] += t_re;
+        im[i] += t_im;
+      }
+    }
+  }
+
+  if (inverse)
+    for (i = 0; i < n; i++)
+    {
+      re[i] /= n;
+      im[i] /= n;
+    }
+}
+
+
+
+/* Fills table (PAULA_BLEP_PHASES sets of PAULA_BLEP_TAPS) with the minBLEP  */
+/* residuals.  A windowed sinc is made minimum phase through its cepstrum,   */
+/* so that all of it comes after the step and none has to be played early,  */
+/* then integrated into a step.  Set p, tap j is what the step still lacks   */
+/* of 1 at j + p / PAULA_BLEP_PHASES output samples after it.                */
+MPstatus PaulaBuildBlep(int16* table)
+{
+  double* re;
+  double* im;
+  double x, m, sum;
+  int i;
+
+  if (!(re = (double*) calloc(2 * BLEP_FFT_SIZE, sizeof(double))))
+    return(MP_NOMEM);
+  im = re + BLEP_FFT_SIZE;
+
+  /* Blackman windowed sinc, PAULA_BLEP_PHASES points per output sample     */
+  for (i = 0; i < BLEP_POINTS; i++)
+  {
+    x = BLEP_CUTOFF * (i - BLEP_POINTS / 2) / PAULA_BLEP_PHASES;
+    re[i] = ((i == BLEP_POINTS / 2) ? 1.0 :
+             sin(PAULA_PI * x) / (PAULA_PI * x)) *
+            (0.42 - 0.5 * cos(2.0 * PAULA_PI * i / (BLEP_POINTS - 1)) +
+             0.08 * cos(4.0 * PAULA_PI * i / (BLEP_POINTS - 1)));
+  }
+
+  /* The real cepstrum, folded onto the positive side, then back            */
+  BlepFft(re, im, BLEP_FFT_SIZE, 0);
+  for (i = 0; i < BLEP_FFT_SIZE; i++)
+  {
+    m = sqrt(re[i] * re[i] + im[i] * im[i]);
+    re[i] = log((m > 1e-12) ? m : 1e-12);
+    im[i] = 0.0;
+  }
+  BlepFft(re, im, BLEP_FFT_SIZE, 1);
+  for (i = 1; i < BLEP_FFT_SIZE / 2; i++)
+  {
+    re[i] *= 2.0;
+    im[i] *= 2.0;
+  }
+  for (i = BLEP_FFT_SIZE / 2 + 1; i < BLEP_FFT_SIZE; i++)
+    re[i] = im[i] = 0.0;
+  BlepFft(re, im, BLEP_FFT_SIZE, 0);
+  for (i = 0; i < BLEP_FFT_SIZE; i++)
+  {
+    m = exp(re[i]);
+    re[i] = m * cos(im[i]);
+    im[i] = m * sin(im[i]);
+  }
+  BlepFft(re, im, BLEP_FFT_SIZE, 1);
+
+  for (sum = 0.0, i = 0; i < BLEP_POINTS; i++)
+    sum += re[i];
+  for (x = 0.0, i = 0; i < BLEP_POINTS; i++)
+  {
+    x += re[i];
+    table[(i % PAULA_BLEP_PHASES) * PAULA_BLEP_TAPS + i / PAULA_BLEP_PHASES] =
+      (int16) floor((1.0 - x / sum) * (1 << PAULA_BLEP_SHIFT) + 0.5);
+  }
+  free(re);
+  return(MP_OK);
+}
+
+
+
+/* Adds the residual of a step of delta (which fits an int16) at phase to    */
+/* the PAULA_BLEP_TAPS sums at acc                                           */
+void PaulaAddStep(const int16* table, int delta, uint32 phase, int* acc)
+{
+  const int16* r = table + phase * PAULA_BLEP_TAPS;
+  int j;
+
+#ifdef HAVE_SSE2
+  /* mullo and mulhi are the low and high halves of the 32 bit products     */
+  __m128i d = _mm_set1_epi16((short) delta);
+  __m128i lo, hi, x;
+
+  for (j = 0; j < PAULA_BLEP_TAPS; j += 8)
+  {
+    x = _mm_loadu_si128((const __m128i*) (r + j));
+    lo = _mm_mullo_epi16(x, d);
+    hi = _mm_mulhi_epi16(x, d);
+    _mm_storeu_si128((__m128i*) (acc + j), _mm_add_epi32(
+      _mm_loadu_si128((const __m128i*) (acc + j)),
+      _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), PAULA_ACC_SHIFT)));
+    _mm_storeu_si128((__m128i*) (acc + j + 4), _mm_add_epi32(
+      _mm_loadu_si128((const __m128i*) (acc + j + 4)),
+      _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), PAULA_ACC_SHIFT)));
+  }
+#else
+  for (j = 0; j < PAULA_BLEP_TAPS; j++)
+    acc[j] += (delta * r[j]) >> PAULA_ACC_SHIFT;
+#endif
+}
+
+
+
+/* The coefficient of a one pole filter with its corner at hz                */
+float OnePole(double hz, uint32 rate)
+{
+  return((float) (1.0 - exp(-2.0 * PAULA_PI * hz / rate)));
+}
+
+
+
+void PaulaSetupFilter(struct paula_filter* filter, int model, uint32 rate)
+{
+  double w, a, c, a0;
+
+  filter->model = model;
+  filter->lp = OnePole((model == MOD_FILTER_A500) ? A500_LP_HZ :
+                       A1200_LP_HZ, rate);
+  filter->hp = OnePole(AMIGA_HP_HZ, rate);
+
+  /* The LED filter as a bilinear two pole low pass                         */
+  w = 2.0 * PAULA_PI * LED_HZ / rate;
+  a = sin(w) / (2.0 * LED_Q);
+  c = cos(w);
+  a0 = 1.0 + a;
+  filter->led_b0 = (float) ((1.0 - c) / 2.0 / a0);
+  filter->led_b1 = (float) ((1.0 - c) / a0);
+  filter->led_b2 = filter->led_b0;
+  filter->led_a1 = (float) (-2.0 * c / a0);
+  filter->led_a2 = (float) ((1.0 - a) / a0);
+}
+
+
+
+/* Runs length levels at y through the low pass, the LED filter (if led)    */
+/* and the high pass, in the order they are on the board.  With the LED     */
+/* filter off its state follows the signal, so that turning it on doesn't   */
+/* click.                                                                    */
+void PaulaFilter(const struct paula_filter* filter,
+                 struct paula_filter_state* state, int led, int* y,
+                 uint32 length)
+{
+  float x, o;
+  uint32 t;
+
+  for (t = 0; t < length; t++)
+  {
+    x = (float) y[t] + FILTER_BIAS;
+    x = (state->lp += filter->lp * (x - state->lp));
+    if (led)
+    {
+      o = filter->led_b0 * x + filter->led_b1 * state->led_x1 +
+          filter->led_b2 * state->led_x2 - filter->led_a1 * state->led_y1 -
+          filter->led_a2 * state->led_y2;
+      state->led_x2 = state->led_x1;
+      state->led_x1 = x;
+      state->led_y2 = state->led_y1;
+      state->led_y1 = o;
+      x = o;
+    }
+    else
+      state->led_x1 = state->led_x2 = state->led_y1 = state->led_y2 = x;
+    state->hp += filter->hp * (x - state->hp);
+    y[t] = (int) floor(x - state->hp + 0.5f);
+  }
+}
+
+
+
+/* Puts the filters at rest on a steady level, as if it had been playing     */
+/* for a long time                                                           */
+void PaulaSettleFilter(struct paula_filter_state* state, int level)
+{
+  state->lp = state->hp = (float) level + FILTER_BIAS;
+  state->led_x1 = state->led_x2 = state->led_y1 = state->led_y2 = state->lp;
+}
+
+
+
+/* Splits a channel's filters between the note going (from) and a new one    */
+/* coming in from silence (to) so that the two add up to what the one would  */
+/* have played.  The low pass and LED state stay with the old note; the      */
+/* high pass, too slow to be let go with it, moves to the new one.           */
+void PaulaHandOverFilter(struct paula_filter_state* from,
+                         struct paula_filter_state* to)
+{
+  PaulaSettleFilter(to, 0);
+  to->hp = from->hp;
+  from->hp = FILTER_BIAS;
+}
+
+
+
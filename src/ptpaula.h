@@ -0,0 +1,57 @@
+/*****************************************************************************/
+/* ptpaula.h v0.1        Amiga (Paula) Output Emulation Declarations         */
+/*                                                                           */
+/* Created by:                                                               */
+/* Email:                                                                    */
+/* Creation Date: Sun Oct 18 19:40:00 UTC 2026                               */
+/* Last Modified:                                                            */
+/* Comments:                                                                 */
+/*****************************************************************************/
+
+#ifndef ptpaula_h
+#define ptpaula_h
+
+#include "mod.h"
+
+
+/* Paula plays a sample by holding each byte until the next one is due, so   */
+/* its output is a staircase.  The player's Paula mode makes each step of    */
+/* the staircase a band-limited step (a minBLEP): the output is the held     */
+/* level less the step's residual, which dies away over PAULA_BLEP_TAPS      */
+/* output samples.  The residuals are tabled for PAULA_BLEP_PHASES points    */
+/* between two output samples, as PAULA_BLEP_SHIFT b.p. fixed point.         */
+#define PAULA_BLEP_TAPS 16
+#define PAULA_BLEP_PHASES 64
+#define PAULA_BLEP_SHIFT 14
+#define PAULA_ACC_SHIFT 6
+/* A step's residual is added in >> PAULA_ACC_SHIFT so that a pile of them   */
+/* can't overflow; the rest of the PAULA_BLEP_SHIFT comes off at the end.    */
+
+struct paula_filter               /* the coefficients for a model and rate  */
+{
+  int model;                       /* MOD_FILTER_ (see ptplay.h)             */
+  float lp, hp;                    /* one pole: y += c * (x - y)            */
+  float led_b0, led_b1, led_b2;    /* the "LED" filter, a two pole low pass */
+  float led_a1, led_a2;            /* switched by effect E0x                */
+};
+
+struct paula_filter_state         /* one for each channel                   */
+{
+  float lp, hp;
+  float led_x1, led_x2, led_y1, led_y2;
+};
+
+MPstatus PaulaBuildBlep(int16* table);
+void     PaulaAddStep(const int16* table, int delta, uint32 phase, int* acc);
+void     PaulaSetupFilter(struct paula_filter* filter, int model, uint32 rate);
+void     PaulaFilter(const struct paula_filter* filter,
+                     struct paula_filter_state* state, int led, int* y,
+                     uint32 length);
+void     PaulaSettleFilter(struct paula_filter_state* state, int level);
+void     PaulaHandOverFilter(struct paula_filter_state* from,
+                             struct paula_filter_state* to);
+
+#endif
+
+
+
@@ -10,711 +10,2560 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "ptplay.h"
+#include "ptpaula.h"
+#include "ptflow.h"
 #include "mod.h"
 #include "mixer.h"
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
 //#pragma optimize("", off)
 
 
-/* A couple of macros to clear/set the volume and increment functions */
-#define SETINCFUN(fun)   chan_state[channel].CalcCurrInc = fun
-#define SETVOLFUN(fun)   chan_state[channel].CalcCurrVol = fun
-#define CLEARINCVOLFUN   chan_state[channel].CalcCurrInc = NULL; \
-                         chan_state[channel].CalcCurrVol = NULL
-#define CLEARVOLFUN      chan_state[channel].CalcCurrVol = NULL
-#define CLEARINCFUN      chan_state[channel].CalcCurrInc = NULL
-
+/* A voice's position in its sample, and its increment (how far that moves  */
+/* for each output sample), are 32.32 fixed point: the index of a sample in  */
+/* the top half and the fraction of the way to the next in the bottom.       */
+#define POS_SHIFT 32
+#define POSINDEX(pos) ((uint32) ((pos) >> POS_SHIFT))
+#define INDEXPOS(index) ((uint64) (index) << POS_SHIFT)
 
+/* A couple of macros to clear/set the volume and increment functions */
+#define SETINCFUN(ch, fun)   (ch)->CalcCurrInc = fun
+#define SETVOLFUN(ch, fun)   (ch)->CalcCurrVol = fun
+#define CLEARINCVOLFUN(ch)   (ch)->CalcCurrInc = NULL; \
+                             (ch)->CalcCurrVol = NULL
+#define CLEARVOLFUN(ch)      (ch)->CalcCurrVol = NULL
+#define CLEARINCFUN(ch)      (ch)->CalcCurrInc = NULL
+
+/* Bits of player.fx_warned: effect e is bit e, E effect x is bit 16 + x     */
+#define FX_WARN_E 16
+
+/* Whether a channel's effect has anything to do after the first tick of     */
+/* its row (see TickEffect): arpeggio with an argument, 1 to 7 and A, and    */
+/* E9x, ECx and EDx with an x.                                               */
+#define FXTICKS(fx)                                                       \
+  (((fx)->effect == 0xE) ?                                                \
+   (((0x3200 >> ((fx)->arg >> 4)) & 1) && ((fx)->arg & 0x0F)) :           \
+   (((fx)->effect || (fx)->arg) && ((0x04FF >> (fx)->effect) & 1)))
+
+/* What PlayTick may glide over a tick (see CalcGlideInc)                    */
+#define FX_GLIDE_PERIOD 1
+#define FX_GLIDE_VOL 2
+
+/* Vibrato and tremolo go round fx_wave in FX_WAVE_STEPS steps, a quarter    */
+/* of one of Protracker's position bytes each.                               */
+#define FX_WAVE_STEPS 64
+#define FXWAVE(wave, pos)                                                 \
+  fx_wave[(((wave) & 3) < 2) ? (wave) & 3 : 2]                            \
+         [((pos) >> 2) & (FX_WAVE_STEPS - 1)]
+
+/* The interpolating kernels (PlayerSetInterpolation) read the int16 copies  */
+/* of the samples (see mod_prep_sample in mod.h) through a table with a set  */
+/* of taps for each of INTERP_PHASES points between two samples.  The taps   */
+/* are INTERP_SHIFT b.p. fixed point and each set adds up to 1.  Tap         */
+/* taps / 2 - 1 of a set falls on the sample at POSINDEX(pos).  The number  */
+/* of phases may be set when building (modrender -k compares the costs).    */
+#ifndef INTERP_PHASE_BITS
+#define INTERP_PHASE_BITS 8
+#endif
+#define INTERP_PHASES (1 << INTERP_PHASE_BITS)
+#define INTERP_SHIFT 14
+#define INTERP_SINC_TAPS 16
+#define INTERP_PI 3.14159265358979323846
+#define INTERPPHASE(pos) ((uint32) (pos) >> (POS_SHIFT - INTERP_PHASE_BITS))
+
+#define INTERPOLATING(pl, ch) \
+  ((ch)->prep && interp_kernel[(pl)->interp_kernel].Interpolate)
+/* The volume as InterpStore4 wants it for format                           */
+#define INTERPVOL(format, vol) \
+  (((format) == MOD_OUT_UINT8) ? _mm_set1_epi16((short) ((vol) << 2)) : \
+                                 _mm_set1_epi32(vol))
+
+/* Every kernel works a voice out as a level: its int16 value times its      */
+/* volume (0 to 64), so full scale is 1 << 21.  These turn a level into the  */
+/* output formats (see PlayerSetOutput).  The byte is on the same scale as   */
+/* (SAMPLETOUNSIGNED(s) * vol) >> 6 for a sample byte s, which is a level    */
+/* of s * (vol << 8).                                                        */
+#define OUTUINT8(level, vol) ((uint8) (((level) + ((vol) << 15)) >> 14))
+#define OUTINT16(level) ((int16) ((level) >> 6))
+#define OUTFLOAT(level) ((float) (level) * (1.0f / (1 << 21)))
+#define OUTSIZE(format) ((format) >> 3)     /* bytes per sample             */
+#define BLEPLEVEL(level) \
+  ((level) * (1 << (PAULA_BLEP_SHIFT - PAULA_ACC_SHIFT)))
+/* Paula mode keeps the level as sample * volume, a step of which must fit   */
+/* an int16 (see PaulaAddStep); its sums are on this scale.                  */
+
+/* Volume ramps (PlayerSetRamp) move the volume once every RAMP_BLOCK        */
+/* samples, so that the kernels still play at a fixed volume.  Each          */
+/* channel's ghost, the note it was playing when a new one started (see      */
+/* RampNote), is kept number_channels on from it.                            */
+#define RAMP_BLOCK 8
+#define GHOST(pl, ch) ((ch) + (pl)->mod->number_channels)
+#define SAMPLEEND(ch)                                                     \
+  (((ch)->repeat_length > 2) ? (ch)->repeat_length + (ch)->repeat_point : \
+                               (ch)->sample_length)
+/* where the sample (or its loop) ends                                       */
+
+/* ResampleSpan's loop, putting out (made from s[POSINDEX(pos)]) in b[i]    */
+/* for a run of n samples that doesn't get to the end of the sample, so it   */
+/* has nothing to look at but the position.                                  */
+#define RESAMPLERUN(b, out)                                               \
+  for (i = 0; i < n; i++, pos += inc)                                     \
+    b[i] = (out);
+
+
+
+struct player;
 
 struct chan_data
 {
-  uint8* sample;
+  const int8* sample;     /* signed, straight from the mod (see mod.h)      */
   uint32 sample_length;
-  uint32 sample_position;
-  /* Interpret as a fixed point value.  The "point" is only 15 positions to  */
-  /* the left as it is possible that the sample position may be a 17 bit no  */
+  uint64 sample_position; /* 32.32 fixed point (see POS_SHIFT)           */
 
   uint32 repeat_point;
   uint32 repeat_length;
-  uint8  clear_val;
-  uint8  curr_samp_vol;   /* current volume */
-  uint32 curr_samp_inc;
-  /* encodes the current period/freq as a fixed point no. */
-
-  uint32 div_samp_inc;
-  /* encoded this divisions period/freq effect parameter. */
-
-  uint32 arpeggio_inc_a;
-  uint32 arpeggio_inc_b;
-  uint32 arpeggio_inc_c;  /* The three arpeggio frequencies i.e. inc amounts */
-  int    arpeggio_one_third_div_pos;
-  int    arpeggio_two_third_div_pos;
-  uint32 slide_delta;     /* a 20 b.p. fixed point no. */
-  uint32 slide_period;    /* a 20 b.p. fixed point no. */
-
-  uint32 (*CalcCurrInc)(int, int);
-  uint32 (*CalcCurrVol)(int, int); 
-  /* points to the correct increment/volume calculating function */
+  uint32 clear_val;       /* the last sample made, as the output's bytes    */
+  uint8  curr_samp_vol;   /* current volume, for this tick (after tremolo)  */
+  uint64 curr_samp_inc;
+  /* encodes the current period/freq as a fixed point no. (32.32) */
+
+  uint16 period;          /* the Amiga period of the note, finetune applied */
+  uint16 play_period;     /* and the one playing this tick (after vibrato,  */
+                          /* arpeggio or glissando)                          */
+  uint8  volume;          /* of the note, which the effects slide           */
+  uint8  finetune;        /* of the sample, as in mod.h                     */
+  uint8  instrument;      /* the sample number of the note (0 for none)     */
+  uint32 note_start;      /* and where in the sample it started (9xx)       */
+  const int16* prep;      /* int16 copy if interpolating (else NULL)        */
+  int    blep_level;      /* Paula mode: the level held (sample * volume),  */
+  int    blep_carry[PAULA_BLEP_TAPS];
+  /* the residuals of its last steps still to come, and the output filters   */
+  struct paula_filter_state filter;
+  int    ramp_vol;        /* volume ramps: the volume (16 b.p.) the ramp is */
+  int    ramp_step;       /* at and its change each sample, the volume it   */
+  uint8  ramp_target;     /* is going to and the samples until it gets      */
+  uint32 ramp_left;       /* there.  Once the sample has ended, ramp_left   */
+  /* is what is left of clear_val's fade to silence (see FadeClearVal).      */
+
+  struct chan_fx
+  {
+    uint8 effect, arg;    /* this row's effect, for TickEffect              */
+    const struct mod_event* delay_ev;
+    /* the event whose note EDx holds back                                   */
+    uint8 porta_speed;    /* the effect memory: 3xx's speed, the note it    */
+    uint16 porta_target;  /* slides to (0 once it gets there) and E3x       */
+    uint8 glissando;
+    uint8 vib_speed, vib_depth, vib_pos, vib_wave;
+    uint8 trem_speed, trem_depth, trem_pos, trem_wave;
+    uint8 offset;         /* 9xx's, in 256s of samples                      */
+    uint16 glide_period;  /* the period and volume played the tick before   */
+    uint8 glide_vol;      /* (see CalcGlideInc)                             */
+  } fx;
+
+  uint64 (*CalcCurrInc)(const struct player*, struct chan_data*, int, int);
+  uint32 (*CalcCurrVol)(const struct player*, struct chan_data*, int, int);
+  /* points to the correct increment/volume calculating function.  They are  */
+  /* called once per span of samples with the division position of its       */
+  /* first sample and its length, and return the value for the whole span.   */
+  /* Only a slide played with an effect block (PlayerSetEffectBlock) has    */
+  /* them; everything else is set once a tick by PlayTick.                  */
 };
 
 
 
-static struct chan_data * chan_state;
-static uint8 pattern,  channel, tpd, song_pos;
-static int8 division; /* division may need to be -1 if a pat break occurs */
-/* static uint8 pattern_break;
- A value of $FF means no pattern break, otherwise the divisions no is given*/
+/* Everything about one playing of one song.  Nothing in here is shared,     */
+/* so any number of players may run at once (in different threads) as long   */
+/* as each has its own sink.  The module itself is only read.                */
+struct player
+{
+  const struct mod_data * mod;     /* the song being played               */
+  const MPmodule * module;         /* and its handle, for ModGetSample     */
+  struct chan_data * chan_state;   /* one per channel, then their ghosts   */
+  uint8 pattern, tpd, song_pos, division;
+  /* pattern is the slot of the current pattern (see mod.h), not its number */
+  struct mod_loop loop;            /* see ModNextRow                       */
+  uint32 row_ticks;                /* tpd, times 1 + EEx's x               */
+  uint32 fx_active;
+  /* bit n is set if channel n's effect has work to do after the first tick  */
+
+  uint8 * tick_buf;                /* a tick of one channel's output       */
+  int out_format;                  /* see PlayerSetOutput                  */
+  uint64 * period_inc;
+  /* the curr_samp_inc of each period at out_rate (see BuildPeriodTables)    */
+  uint16 note_period[MOD_NUM_FINETUNES][MOD_NUM_NOTES];
+  /* the period of each note at each finetune                                */
+  uint32 out_rate, tick_buf_size, max_tick;
+  /* tick_buf_size is the current amount of the tick_buf that is being used. */
+  /* It is a function  of the output rate and the bpm setting.               */
+  /* max_tick is the most it can be at out_rate (at MOD_MIN_TEMPO), which    */
+  /* the tick buffers are made to hold.                                      */
+
+  uint32 fx_block;                 /* see PlayerSetEffectBlock             */
+  uint32 ramp_length;              /* see PlayerSetRamp                    */
+  uint8 * ramp_buf;                /* a tick of a ghost's output           */
+  int interp_kernel;               /* see PlayerSetInterpolation           */
+  int16 * interp_table;            /* the taps: INTERP_PHASES sets         */
+  int * paula_buf;                 /* Paula mode's residuals and levels    */
+  struct paula_filter filter;      /* see PlayerSetFilter                  */
+  int led;                         /* the LED (and its filter) is on       */
+  uint32 sample_pos;               /* output samples since the start       */
+  uint32 skip_samples;             /* still to step over (PlayerSeekSample)*/
+  const struct mod_row * started_row;
+  /* a row that StepTo has started but not played                            */
+
+  int loops, loops_left;           /* see PlayerSetLoop                      */
+  uint32 fade_length, fade_left;   /* in samples; fade_left is 0 unless the  */
+  uint32 fade_gain;                /* song is fading out.  The gain is 16    */
+  int ended;                       /* b.p. and is set for each tick.         */
+  uint8 played[MOD_PATTERN_TABLE_SIZE * MOD_NUM_DIVISIONS / 8];
+  /* a bit for each row (order * 64 + division) played since the last loop   */
+
+  struct player_snap * seek_snap;  /* see PlayerBuildSeekIndex             */
+  uint32 seek_count, seek_snap_size;
+  uint32 * seek_row_pos;
+  /* the sample_pos at which each row (order * 64 + division) is first       */
+  /* played, or MOD_NOT_PLAYED                                               */
+
+  int prefetch_rows;               /* see PlayerSetPrefetch                */
+  MPsink sink;                     /* where the ticks go (PlayerSetSink)   */
+  void * sink_data;
+  MPsink stem_sink;                /* and each channel's, if set           */
+  void * stem_data;                /* (PlayerSetStems)                     */
+  uint32 fx_warned;                /* "Not Implemented" already said       */
+};
 
-static uint8 * tick_buf;
-static uint32 out_rate, tick_buf_size, max_div_pos;
-/* tick_buf_size is the current amount of the tick_buf that is being used.   */
-/* It is a function  of the output rate and the bpm setting.                 */
-/* max_div_pos will be the product of the current tpd and tick_buf_size      */
+/* A snapshot of a player between rows, for seeking.  The channels run on    */
+/* past the end: there are really number_channels of them, and as many       */
+/* ghosts.                                                                   */
+struct player_snap
+{
+  uint32 sample_pos, tick_buf_size, fx_active;
+  uint8 song_pos, division, tpd, led;
+  struct mod_loop loop;
+  struct chan_data chan[1];
+};
 
-/* I still need to make more of the stuff static */
-static MPstatus InitializePlayer(void);
-static MPstatus ResampleTick(int tick_no);
-static MPstatus PlayDivision(void);
+#define MOD_NOT_PLAYED 0xFFFFFFFFUL
+#define SNAPAT(pl, n)                                                     \
+  ((struct player_snap*)                                                  \
+   ((uint8*) (pl)->seek_snap + (n) * (pl)->seek_snap_size))
+
+static void ResetPlayer(MPplayer* pl);
+static MPstatus StartRow(MPplayer* pl, const struct mod_row** ret_row);
+static int NextRow(MPplayer* pl, const struct mod_row* row);
+static void ForgetRows(uint8* bits, uint32 song_pos, uint32 from, uint32 to);
+static int LoopCheck(MPplayer* pl);
+static void MarkPlayed(MPplayer* pl);
+static void SaveSnapshot(const MPplayer* pl, struct player_snap* snap);
+static void LoadSnapshot(MPplayer* pl, const struct player_snap* snap);
+static MPstatus StepTo(MPplayer* pl, uint32 sample, uint32 target_row);
+static MPstatus ResampleTick(MPplayer* pl, struct chan_data* ch, int tick_no,
+                             uint8* buf);
+static void GhostTick(MPplayer* pl, struct chan_data* g, uint8* buf);
+static uint32 PlaySpan(const MPplayer* pl, struct chan_data* ch, uint8* buf,
+                       uint32 length, uint8 vol, uint32 end);
+static uint8 RampBlock(struct chan_data* ch, uint32* length);
+static uint32 StepsToEnd(uint64 pos, uint64 inc, uint32 end, uint32 most);
+static uint32 SkipSpan(const MPplayer* pl, struct chan_data* ch,
+                       uint32 length, uint8 vol, uint32 end);
+static uint32 ResampleSpan(const MPplayer* pl, struct chan_data* ch,
+                           uint8* buf, uint32 length, uint8 vol, uint32 end);
+static uint32 BlepSpan(const MPplayer* pl, struct chan_data* ch, uint8* buf,
+                       uint32 length, uint8 vol, uint32 end);
+static uint32 SkipBlep(const MPplayer* pl, struct chan_data* ch,
+                       uint32 length, uint8 vol, uint32 end);
+static uint32 InterpSpan(const MPplayer* pl, struct chan_data* ch,
+                         uint8* buf, uint32 length, uint8 vol, uint32 end);
+static double InterpWeight(int kernel, double x);
+static void InterpTaps(const int16* s, const int16* table, int taps,
+                       uint64 pos, uint64 inc, uint32 length, uint8 vol,
+                       int format, uint8* buf);
+static void InterpLinear(const int16* s, const int16* table, uint64 pos,
+                         uint64 inc, uint32 length, uint8 vol, int format,
+                         uint8* buf);
+static void InterpCubic(const int16* s, const int16* table, uint64 pos,
+                        uint64 inc, uint32 length, uint8 vol, int format,
+                        uint8* buf);
+static void InterpSinc(const int16* s, const int16* table, uint64 pos,
+                       uint64 inc, uint32 length, uint8 vol, int format,
+                       uint8* buf);
+static void StoreLevel(int format, uint8* buf, int level, uint8 vol);
+#ifdef HAVE_SSE2
+static void InterpStore4(__m128i y, __m128i volv, int format, uint8* buf);
+static __m128i InterpPair(const int16* p);
+static __m128i InterpCubic2(const int16* s, const int16* table, uint64 p,
+                            uint64 q);
+static __m128i InterpSinc1(const int16* s, const int16* table, uint64 p);
+#endif
+static MPstatus PlayDivision(MPplayer* pl, int silent);
+static int QuietTick(const MPplayer* pl, struct chan_data* ch);
+static void SetupChannel(MPplayer* pl, struct chan_data* ch,
+                         const struct mod_event* ev);
+static void SetupNote(MPplayer* pl, struct chan_data* ch,
+                      const struct mod_event* ev);
+static void StartNote(MPplayer* pl, struct chan_data* ch, uint32 start);
+static void RampNote(MPplayer* pl, struct chan_data* ch);
+static MPstatus ProcessEffect(MPplayer* pl, struct chan_data* ch,
+                              const struct mod_event* ev);
+static MPstatus ProcessEEffect(MPplayer* pl, struct chan_data* ch,
+                               uint8 effect, uint8 x);
+static void TickEffect(MPplayer* pl, struct chan_data* ch, int tick);
+static void PlayTick(const MPplayer* pl, struct chan_data* ch, int period,
+                     int vol, int glide);
+static uint16 TonePortamento(const MPplayer* pl, struct chan_data* ch);
+static uint8 VolumeSlide(uint8 vol, uint8 arg);
+static int WaveDelta(uint8 wave, uint8 pos, uint8 depth, int shift);
+static MPstatus ProcessRow(MPplayer* pl, const struct mod_row* row);
+static int FirstWarning(MPplayer* pl, int bit);
+static void BuildPeriodTables(MPplayer* pl);
+static uint16 TunePeriod(const MPplayer* pl, uint16 period, uint8 finetune);
+static int PeriodNote(const MPplayer* pl, uint16 period, uint8 finetune);
+static void ClearTickBuffer(MPplayer* pl, struct chan_data* ch, uint32 from);
+static uint32 FadeClearVal(MPplayer* pl, struct chan_data* ch, uint32 from);
+static void AddTick(const MPplayer* pl, uint8* buf, const uint8* from,
+                    uint32 length);
+static int MixSink(void* sink_data, int channel_id, void** samples,
+                   int length);
+static uint64 CalcGlideInc(const MPplayer* pl, struct chan_data* ch,
+                           int div_pos, int span);
+static uint32 CalcGlideVol(const MPplayer* pl, struct chan_data* ch,
+                           int div_pos, int span);
+
+
+
+static const uint16 note_period_0[MOD_NUM_NOTES] =
+{
+  856, 808, 762, 720, 678, 640, 604, 570, 538, 508, 480, 453,
+  428, 404, 381, 360, 339, 320, 302, 285, 269, 254, 240, 226,
+  214, 202, 190, 180, 170, 160, 151, 143, 135, 127, 120, 113
+};
+/* The Protracker periods of C-1 to B-3 with no finetune.  These are what    */
+/* a mod's patterns store; the finetuned ones are worked out from them.      */
 
+static const uint32 finetune_factor[MOD_NUM_FINETUNES] =
+{
+  0x10000, 0x0FE29, 0x0FC54, 0x0FA84, 0x0F8B6, 0x0F6EC, 0x0F525, 0x0F362,
+  0x10F39, 0x10D45, 0x10B56, 0x10969, 0x10780, 0x1059B, 0x103B9, 0x101DB
+};
+/* The period is multiplied by these (16 b.p. fixed point) for finetunes     */
+/* 0 to 7 and -8 to -1, i.e. 2^(-f/96): a finetune step is 1/8 semitone.     */
+/* The results are within a period or so of Protracker's own tables.         */
 
+static const int16 fx_wave[3][FX_WAVE_STEPS] =
+{
+  {    0,   24,   49,   74,   97,  120,  141,  161,
+     180,  197,  212,  224,  235,  244,  250,  253,
+     255,  253,  250,  244,  235,  224,  212,  197,
+     180,  161,  141,  120,   97,   74,   49,   24,
+       0,  -24,  -49,  -74,  -97, -120, -141, -161,
+    -180, -197, -212, -224, -235, -244, -250, -253,
+    -255, -253, -250, -244, -235, -224, -212, -197,
+    -180, -161, -141, -120,  -97,  -74,  -49,  -24 },
+  {    0,    8,   16,   24,   32,   40,   48,   56,
+      64,   72,   80,   88,   96,  104,  112,  120,
+     128,  136,  144,  152,  160,  168,  176,  184,
+     192,  200,  208,  216,  224,  232,  240,  248,
+    -255, -247, -239, -231, -223, -215, -207, -199,
+    -191, -183, -175, -167, -159, -151, -143, -135,
+    -127, -119, -111, -103,  -95,  -87,  -79,  -71,
+     -63,  -55,  -47,  -39,  -31,  -23,  -15,   -7 },
+  {  255,  255,  255,  255,  255,  255,  255,  255,
+     255,  255,  255,  255,  255,  255,  255,  255,
+     255,  255,  255,  255,  255,  255,  255,  255,
+     255,  255,  255,  255,  255,  255,  255,  255,
+    -255, -255, -255, -255, -255, -255, -255, -255,
+    -255, -255, -255, -255, -255, -255, -255, -255,
+    -255, -255, -255, -255, -255, -255, -255, -255,
+    -255, -255, -255, -255, -255, -255, -255, -255 }
+};
+/* The vibrato and tremolo waveforms (E4x and E7x): sine, ramp and square,   */
+/* as Protracker makes them from its table of half a sine.  The first half   */
+/* of a cycle adds to the period (or volume), the second takes away.         */
 
-static uint32 semitone_factor[] =
+static const struct interp_kernel
 {
-  0x00002000, 0x000021E7, 0x000023EB, 0x0000260E,
-  0x00002851, 0x00002AB7, 0x00002D41, 0x00002FF2,
-  0x000032CC, 0x000035D1, 0x00003904, 0x00003C68,
-  0x00004000, 0x000043CE, 0x000047D6, 0x00004C1C
+  int taps;
+  void (*Interpolate)(const int16*, const int16*, uint64, uint64, uint32,
+                      uint8, int, uint8*);
+} interp_kernel[MOD_INTERP_KERNELS] =
+{
+  { 1, NULL },                     /* nearest: ResampleSpan does it        */
+  { 2, InterpLinear },
+  { 4, InterpCubic },
+  { INTERP_SINC_TAPS, InterpSinc },
+  { PAULA_BLEP_TAPS, NULL }        /* Paula: BlepSpan does it              */
 };
-/* This table is the set of factors that will inc a pitch by a semitone.     */
-/* They are stored as 13 b.p. fixed point numbers.  The 13 is because when   */
-/* multiplied by the 15 b.p. curr_samp_inc amount we have a 28 b.p. number.  */
-/* The four upper bits are required in case curr_samp_inc is not just        */
-/* fractional.  i.e. max val curr_samp_inc = aprox 16. worst case:           */
-/* out_rate = 4000Hz, resample rate = 60KHz => curr_samp_inc = 15            */
-/* The values are 2^(x/12), where x=0,1,2,...  The table saves work as well  */
-/* as being more accurate.  ex. 44100Hz up 15 semitones  should be 104888.07 */
-/* while the table would give 104888.01.  For smaller numbers results will be*/
-/* better.                                                                   */
+/* Interpolate makes length samples from s (a prep copy) starting at pos,    */
+/* going up by inc, without looking for the end of the sample.  They go in   */
+/* buf in the output format given.                                           */
 
 
 
-MPstatus InitializePlayer(void)
+/* Gets a player ready to play module from the start.  Its output goes to    */
+/* Mix, at out_rate, until PlayerSetSink says otherwise.  The tick buffers   */
+/* are sized for the longest tick at out_rate, so any rate above 0 will do.  */
+MPstatus PlayerCreate(const MPmodule* module, int out_rate,
+                      MPplayer** ret_player)
 {
-//  int n;
-  int default_bpm = 125;
-
-  out_rate = MixerGetRate();
+  MPplayer* pl;
 
-  /* I think this is the fastest way to do this...                           */
-  tick_buf_size = (5 * out_rate)/(default_bpm << 1);
-  tpd = 6;
-  max_div_pos = (tick_buf_size * tpd) - 1;
+  if (out_rate <= 0)
+    return(MP_BADARGS);
+  if (!(pl = (MPplayer*) calloc(1, sizeof(MPplayer))))
+    return(MP_NOMEM);
+  pl->module = module;
+  pl->mod = ModGetData(module);
+  pl->out_rate = out_rate;
+  pl->max_tick = MODTICKSIZE(pl->out_rate, MOD_MIN_TEMPO);
+  pl->sink = MixSink;
+  pl->out_format = MOD_OUT_UINT8;
 
   /* We have to allocate the largest possible amount since the bpm rate may  */
-  /* change mid-song, and the rate may change between songs.                 */
-  if (!(tick_buf = (uint8*) malloc(MAX_TICK_BUFFER_SIZE)))
+  /* change mid-song.  PlayerSetOutput makes it bigger for wider formats.    */
+  if (!(pl->tick_buf =
+        (uint8*) malloc(pl->max_tick * OUTSIZE(pl->out_format))) ||
+      !(pl->period_inc =
+        (uint64*) malloc(MOD_PERIOD_LIMIT * sizeof(uint64))) ||
+      !(pl->chan_state = (struct chan_data *) 
+        malloc(2 * pl->mod->number_channels * sizeof(struct chan_data))))
+  {
+    PlayerFree(pl);
     return(MP_NOMEM);
+  }
+  BuildPeriodTables(pl);
+  ResetPlayer(pl);
+  pl->seek_snap_size = sizeof(struct player_snap) +
+    (2 * pl->mod->number_channels - 1) * sizeof(struct chan_data);
+  *ret_player = pl;
+  return(MP_OK);
+}
 
-  if (!(chan_state = (struct chan_data *) 
-                     malloc(mod.number_channels * sizeof(struct chan_data))))
-    return(MP_NOMEM);
+
+
+/* Puts the player back at the start of the song with nothing playing        */
+void ResetPlayer(MPplayer* pl)
+{
+  struct chan_data* ch;
+
+  pl->tick_buf_size = MODTICKSIZE(pl->out_rate, MOD_DEFAULT_TEMPO);
+  pl->tpd = MOD_DEFAULT_SPEED;
+  pl->row_ticks = pl->tpd;
 
   /* I think the only one that needs setting is sample to NULL.  Try this    */
   /* later.  For now, we reset everything.                                   */
   /* The convention is that is the sample pointer is set to NULL then the    */
   /* channel is turned off.                                                  */
-  for (channel = 0; channel < mod.number_channels; channel++)
+  pl->fx_active = 0;
+  pl->song_pos = 0;
+  pl->division = 0;
+  pl->loop.row = pl->loop.left = 0;
+  pl->sample_pos = 0;
+  pl->skip_samples = 0;
+  pl->started_row = NULL;
+  pl->loops_left = pl->loops;
+  pl->fade_left = 0;
+  pl->ended = 0;
+  pl->led = 0;
+  memset(pl->played, 0, sizeof(pl->played));
+  for (ch = pl->chan_state;
+       ch < pl->chan_state + 2 * pl->mod->number_channels; ch++)
   {
-    chan_state[channel].sample_position = 0;
+    ch->sample_position = 0;
     /* do we want to ignore frst 2 byts?*/
 
-    chan_state[channel].sample = NULL;      /* required */
-    chan_state[channel].clear_val = 0;      /* required */
-    chan_state[channel].sample_length = 0;
-    chan_state[channel].curr_samp_inc = 0;  /* may not be necessary but keep */
-    chan_state[channel].div_samp_inc = 0;   /* may not be necessary but keep */
-    chan_state[channel].curr_samp_vol = 0;  /* may not be necessary but keep */
-    chan_state[channel].CalcCurrInc = NULL; /* required */
-    chan_state[channel].CalcCurrVol = NULL; /* required */
-    chan_state[channel].slide_delta = 0;    /* not sure if required */
-    chan_state[channel].slide_delta = 0;    /* not sure if required */
+    ch->sample = NULL;      /* required */
+    ch->clear_val = 0;      /* required */
+    ch->sample_length = 0;
+    ch->curr_samp_inc = 0;  /* may not be necessary but keep */
+    ch->period = 0;         /* required (slides and arpeggio check it) */
+    ch->play_period = 0;
+    ch->volume = 0;
+    ch->finetune = 0;
+    ch->instrument = 0;
+    ch->note_start = 0;
+    memset(&ch->fx, 0, sizeof(ch->fx));
+    ch->prep = NULL;
+    ch->blep_level = 0;
+    memset(ch->blep_carry, 0, sizeof(ch->blep_carry));
+    PaulaSettleFilter(&ch->filter, 0);
+    ch->ramp_vol = 0;
+    ch->ramp_step = 0;
+    ch->ramp_target = 0;
+    ch->ramp_left = 0;
+    ch->curr_samp_vol = 0;  /* may not be necessary but keep */
+    ch->CalcCurrInc = NULL; /* required */
+    ch->CalcCurrVol = NULL; /* required */
   };
-  return(MP_OK);
 }
 
 
 
-void ClearTickBuffer(void)
+void PlayerFree(MPplayer* pl)
 {
-  uint32 t;
-  for (t = 0; t < tick_buf_size; t++)
-    tick_buf[t] = chan_state[channel].clear_val;
+  if (!pl)
+    return;
+  free(pl->tick_buf);
+  free(pl->period_inc);
+  free(pl->chan_state);
+  free(pl->seek_snap);
+  free(pl->seek_row_pos);
+  free(pl->interp_table);
+  free(pl->paula_buf);
+  free(pl->ramp_buf);
+  free(pl);
 }
 
 
 
-uint32 CalcArpeggioInc(int tick, int tick_pos)
+/* Sends the player's output to sink instead of Mix.  A sink gets the same   */
+/* arguments as Mix (see mixer.h) plus sink_data.                            */
+void PlayerSetSink(MPplayer* pl, MPsink sink, void* sink_data)
 {
-  int div_pos = (tick*(int)tick_buf_size)+tick_pos;
-  if (div_pos <= chan_state[channel].arpeggio_one_third_div_pos)
-    return(chan_state[channel].arpeggio_inc_a);
+  pl->sink = sink;
+  pl->sink_data = sink_data;
+}
 
-  if (div_pos <= chan_state[channel].arpeggio_two_third_div_pos)
-    return(chan_state[channel].arpeggio_inc_b);
 
-  if (div_pos < (int)max_div_pos)
-    return(chan_state[channel].arpeggio_inc_c);
 
-  return(chan_state[channel].arpeggio_inc_a);
-  /* We must be at the end of the sample if this return is reached */
+/* Stems: each channel's ticks also go to sink (NULL for none) as they are   */
+/* made, so one pass plays the mix and writes every channel on its own.      */
+/* A stem is the channel at its volume, as the mix gets it.  The stem sink   */
+/* is called just before the mix's, with its own pointer to the same         */
+/* samples, so neither may change them.  MixerGetChanIndex gives the         */
+/* channel from the id.                                                      */
+void PlayerSetStems(MPplayer* pl, MPsink sink, void* sink_data)
+{
+  pl->stem_sink = sink;
+  pl->stem_data = sink_data;
 }
 
 
 
-uint32 CalcSlideUpInc(int tick, int tick_pos)
+/* The format of the samples sent to the sink: MOD_OUT_UINT8 (the            */
+/* default), _INT16 or _FLOAT.  The wider ones keep all of the precision of  */
+/* the resampled voice at its volume; the byte keeps the top 8 bits of it.   */
+/* Set it before playing or building a seek index.  The tick buffers are    */
+/* resized to a tick of the format.                                          */
+MPstatus PlayerSetOutput(MPplayer* pl, int format)
 {
-  if (((chan_state[channel].slide_period -= chan_state[channel].slide_delta)
-                                         >> 20) < MOD_SLIDE_MIN_PER)
+  uint8* buf;
+
+  if ((format != MOD_OUT_UINT8) && (format != MOD_OUT_INT16) &&
+      (format != MOD_OUT_FLOAT))
+    return(MP_BADARGS);
+  if (OUTSIZE(format) > OUTSIZE(pl->out_format))
   {
-    chan_state[channel].slide_delta = 0; /* This avoids a nasty bug I think */
-    return(chan_state[channel].curr_samp_inc);
+    if (!(buf = (uint8*) realloc(pl->tick_buf,
+                                 pl->max_tick * OUTSIZE(format))))
+      return(MP_NOMEM);
+    pl->tick_buf = buf;
+    if (pl->ramp_buf)
+    {
+      if (!(buf = (uint8*) realloc(pl->ramp_buf,
+                                   pl->max_tick * OUTSIZE(format))))
+        return(MP_NOMEM);
+      pl->ramp_buf = buf;
+    }
   }
-  else
-    return(((AMIGA_CLOCK / (chan_state[channel].slide_period >> 19)) 
-             << 15) / out_rate);
+  pl->out_format = format;
+  return(MP_OK);
 }
 
 
 
-uint32 CalcSlideDownInc(int tick, int tick_pos)
+/* With a lazily loaded module (ModLoadLazy), read the samples of the next   */
+/* rows rows ahead of time rather than when they are first played.  0        */
+/* (the default) turns it off.  It has no effect on other modules.           */
+void PlayerSetPrefetch(MPplayer* pl, int rows)
 {
-  if (((chan_state[channel].slide_period += chan_state[channel].slide_delta)
-                                         >> 20) > MOD_SLIDE_MAX_PER)
-  {
-    chan_state[channel].slide_delta = 0; /* This avoids a nasty bug I think */
-    return(chan_state[channel].curr_samp_inc);
-  }
-  else
-    return(((AMIGA_CLOCK / (chan_state[channel].slide_period >> 19))
-             << 15) / out_rate);
+  pl->prefetch_rows = rows;
 }
 
 
 
-MPstatus ProcessEEffect(uint8 effect, uint8 x)
+/* When the song gets back to a row it has already played it has looped.     */
+/* loops is the number of times it may do that before the player stops: 0    */
+/* (the default) stops it at the first loop and MOD_LOOP_FOREVER never       */
+/* does.  With a fade_ms the player doesn't stop there but goes on round,    */
+/* fading out over fade_ms milliseconds.  A song that ends just ends.        */
+void PlayerSetLoop(MPplayer* pl, int loops, int fade_ms)
 {
-  static uint8 effect1msg = 0;
-  static uint8 effect2msg = 0;
-  static uint8 effect3msg = 0;
-  static uint8 effect4msg = 0;
-  static uint8 effect5msg = 0;
-  static uint8 effect6msg = 0;
-  static uint8 effect7msg = 0;
+  pl->loops = pl->loops_left = (loops < 0) ? MOD_LOOP_FOREVER : loops;
+  pl->fade_length = (fade_ms > 0) ?
+    (uint32) (((uint64) fade_ms * pl->out_rate) / 1000) : 0;
+}
 
-  static uint8 effect9msg = 0;
-  static uint8 effectAmsg = 0;
-  static uint8 effectBmsg = 0;
-  static uint8 effectCmsg = 0;
-  static uint8 effectDmsg = 0;
-  static uint8 effectEmsg = 0;
-  static uint8 effectFmsg = 0;
-  switch (effect)
+
+
+/* How often (in output samples) the running effects are worked out.  The    */
+/* default, 0, is once a tick, as Protracker does.  With blocks a pitch or   */
+/* volume slide moves on from the last tick's value in steps over the tick   */
+/* rather than all at once; smaller blocks cost more, and 1 is every sample. */
+void PlayerSetEffectBlock(MPplayer* pl, int samples)
+{
+  pl->fx_block = (samples > 0) ? samples : 0;
+}
+
+
+
+/* Volume ramps, against clicks.  With samples above 0 a channel's volume    */
+/* goes to each new value in a straight line over that many samples (in      */
+/* steps of 8), a new note (or a cut) fades the old one out as it fades in   */
+/* from silence, and a sample that ends fades from its last value to         */
+/* silence.  0 (the default) turns them off.  Set it before playing or       */
+/* building a seek index.                                                    */
+MPstatus PlayerSetRamp(MPplayer* pl, int samples)
+{
+  if ((samples > 0) && !pl->ramp_buf &&
+      !(pl->ramp_buf =
+        (uint8*) malloc(pl->max_tick * OUTSIZE(pl->out_format))))
+    return(MP_NOMEM);
+  pl->ramp_length = (samples > 0) ? samples : 0;
+  return(MP_OK);
+}
+
+
+
+/* Picks how the samples are resampled (MOD_INTERP_NEAREST, the default,     */
+/* _LINEAR, _CUBIC or _SINC) or MOD_INTERP_PAULA.  Linear, cubic and sinc    */
+/* play the int16 copies of the samples, so ModPrepareSamples(module,        */
+/* MOD_PREP_INT16) must have been called; without them the player stays      */
+/* with nearest.  A change is heard from each channel's next note.           */
+MPstatus PlayerSetInterpolation(MPplayer* pl, int kernel)
+{
+  double w[INTERP_SINC_TAPS], sum;
+  int16* table;
+  int taps, phase, k, big, total;
+
+  if ((kernel < 0) || (kernel >= MOD_INTERP_KERNELS))
+    return(MP_BADARGS);
+  free(pl->interp_table);
+  pl->interp_table = NULL;
+  pl->interp_kernel = MOD_INTERP_NEAREST;
+  if (kernel == MOD_INTERP_NEAREST)
+    return(MP_OK);
+
+  if (kernel == MOD_INTERP_PAULA)
   {
-  case 0x0:  /* Filter on/off */
-    switch (x)
+    if (!(table = (int16*) malloc(PAULA_BLEP_PHASES * PAULA_BLEP_TAPS *
+                                  sizeof(int16))))
+      return(MP_NOMEM);
+    if ((!pl->paula_buf && !(pl->paula_buf = (int*) malloc(
+          (2 * pl->max_tick + PAULA_BLEP_TAPS) * sizeof(int)))) ||
+        (PaulaBuildBlep(table) != MP_OK))
     {
-    case 1:
-      printf("Filter/Power LED off\n");
-      break;
-    case 0:
-      printf("Filter/Power LED on\n");
-      break;
-    default:
-      return(MP_BADEFFECT);
+      free(table);
+      return(MP_NOMEM);
     }
-    CLEARINCVOLFUN;
-    break;
+    pl->interp_table = table;
+    pl->interp_kernel = kernel;
+    return(MP_OK);
+  }
 
-  case 0x1:  /* Fineslide up */
-    if (!effect1msg)
-      printf("Fineslide up Not Implemented Yet.\n");
-    effect1msg = 1;
-    CLEARINCVOLFUN;
-    break;
+  taps = interp_kernel[kernel].taps;
+  if (!(table = (int16*) malloc(INTERP_PHASES * taps * sizeof(int16))))
+    return(MP_NOMEM);
+  for (phase = 0; phase < INTERP_PHASES; phase++)
+  {
+    for (sum = 0.0, k = 0; k < taps; k++)
+      sum += (w[k] = InterpWeight(kernel, (k - (taps / 2 - 1)) -
+                                  (double) phase / INTERP_PHASES));
 
-  case 0x2:  /* Fineslide down */
-    if (!effect2msg)
-      printf("Fineslide down Not Implemented Yet.\n");
-    effect2msg = 1;
-    CLEARINCVOLFUN;
-    break;
+    /* Rounding may leave the set a little off 1; the biggest tap takes it   */
+    for (total = 0, big = 0, k = 0; k < taps; k++)
+    {
+      table[phase * taps + k] =
+        (int16) floor(w[k] / sum * (1 << INTERP_SHIFT) + 0.5);
+      total += table[phase * taps + k];
+      if (w[k] > w[big])
+        big = k;
+    }
+    table[phase * taps + big] += (int16) ((1 << INTERP_SHIFT) - total);
+  }
+  pl->interp_table = table;
+  pl->interp_kernel = kernel;
+  return(MP_OK);
+}
 
-  case 0x3:  /* Set Glissando */
-    if (!effect3msg)
-      printf("Set Glissando Not Implemented Yet.\n");
-    effect3msg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0x4:  /* Set Vibrato Waveform */
-    if (!effect4msg)
-      printf("Set Vibrato Waveform Not Implemented Yet.\n");
-    effect4msg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0x5:  /* Set Finetune */
-    if (!effect5msg)
-      printf("Set Finetune Not Implemented Yet.\n");
-    effect5msg = 1;
-    CLEARINCVOLFUN;
-    break;
+/* Which of the Amiga's output filters Paula mode plays through:             */
+/* MOD_FILTER_NONE (the default), _A500 or _A1200.  Both models have the     */
+/* LED filter, which effect E0x turns on and off.                            */
+MPstatus PlayerSetFilter(MPplayer* pl, int model)
+{
+  if ((model < MOD_FILTER_NONE) || (model > MOD_FILTER_A1200))
+    return(MP_BADARGS);
+  PaulaSetupFilter(&pl->filter, model, pl->out_rate);
+  return(MP_OK);
+}
 
-  case 0x6:  /* Patternloop */
-    if (!effect6msg)
-      printf("Patternloop Not Implemented Yet.\n");
-    effect6msg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0x7:  /* Set Tremolo Waveform */
-    if (!effect7msg)
-      printf("Set Tremolo Waveform Not Implemented Yet.\n");
-    effect7msg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0x8:  /* Invalid Effect */
-    CLEARINCVOLFUN;
-    return(MP_BADEFFECT);
+/* The kernel's weight for a sample x samples away from the point played     */
+double InterpWeight(int kernel, double x)
+{
+  x = fabs(x);
+  switch (kernel)
+  {
+  case MOD_INTERP_LINEAR:
+    return((x < 1.0) ? 1.0 - x : 0.0);
+
+  case MOD_INTERP_CUBIC:  /* Hermite with Catmull-Rom slopes */
+    if (x < 1.0)
+      return((1.5 * x - 2.5) * x * x + 1.0);
+    if (x < 2.0)
+      return(((-0.5 * x + 2.5) * x - 4.0) * x + 2.0);
+    return(0.0);
+
+  default:                /* sinc with a Blackman window */
+    if (x < 1e-9)
+      return(1.0);
+    if (x >= INTERP_SINC_TAPS / 2)
+      return(0.0);
+    return(sin(INTERP_PI * x) / (INTERP_PI * x) *
+           (0.42 + 0.5 * cos(2.0 * INTERP_PI * x / INTERP_SINC_TAPS) +
+            0.08 * cos(4.0 * INTERP_PI * x / INTERP_SINC_TAPS)));
+  }
+}
 
-  case 0x9:  /* Retrigger Sample */
-    if (!effect9msg)
-      printf("Retrigger Sample Not Implemented Yet.\n");
-    effect9msg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0xA:  /* Fine Volume Slide up */
-    if (!effectAmsg)
-      printf("Fine Volume Slide up Not Implemented Yet.\n");
-    effectAmsg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0xB:  /* Fine Volume Slide down */
-    if (!effectBmsg)
-      printf("Fine Volume Slide down Not Implemented Yet.\n");
-    effectBmsg = 1;
-    CLEARINCVOLFUN;
-    break;
+/* The default sink: the one and only mixer                                  */
+int MixSink(void* sink_data, int channel_id, void** samples, int length)
+{
+  (void) sink_data;
+  return(Mix(channel_id, samples, length));
+}
 
-  case 0xC:  /* Cut Sample */
-    if (!effectCmsg)
-      printf("Cut Sample Not Implemented Yet.\n");
-    effectCmsg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0xD:  /* Delay Sample */
-    if (!effectDmsg)
-      printf("Delay Sample Not Implemented Yet.\n");
-    effectDmsg = 1;
-    CLEARINCVOLFUN;
-    break;
 
-  case 0xE:  /* Delay Pattern */
-    if (!effectEmsg)
-      printf("Delay Pattern Not Implemented Yet.\n");
-    effectEmsg = 1;
-    CLEARINCVOLFUN;
-    break;
+/* Works out the increment of every period at the player's rate, and the     */
+/* period of every note at every finetune, so that playing never has to      */
+/* divide.  Period 0 gets an increment of 0.  Paula plays a period p at     */
+/* AMIGA_CLOCK / 2p samples a second; the increment is rounded to 32 b.p.    */
+void BuildPeriodTables(MPplayer* pl)
+{
+  uint64 d;
+  uint32 p;
+  int f, n;
 
-  case 0xF:  /* Invert Loop */
-    if (!effectFmsg)
-      printf("Invert Loop Not Implemented Yet.\n");
-    effectFmsg = 1;
-    CLEARINCVOLFUN;
-    break;
+  pl->period_inc[0] = 0;
+  for (p = 1; p < MOD_PERIOD_LIMIT; p++)
+  {
+    d = (uint64) (p << 1) * pl->out_rate;
+    pl->period_inc[p] = (((uint64) AMIGA_CLOCK << POS_SHIFT) + (d >> 1)) / d;
   }
-  return(MP_OK);
+
+  for (f = 0; f < MOD_NUM_FINETUNES; f++)
+    for (n = 0; n < MOD_NUM_NOTES; n++)
+      pl->note_period[f][n] = (uint16)
+        ((note_period_0[n] * finetune_factor[f] + 0x8000) >> 16);
 }
 
 
 
-MPstatus ProcessEffect(void)
+/* Gives the period that a pattern's period (which presumes no finetune)     */
+/* really plays at with the given finetune.  The notes come from the note    */
+/* table; anything else is scaled.                                           */
+uint16 TunePeriod(const MPplayer* pl, uint16 period, uint8 finetune)
 {
-  static uint8 effect3msg = 0;
-  static uint8 effect4msg = 0;
-  static uint8 effect5msg = 0;
-  static uint8 effect6msg = 0;
-  static uint8 effect7msg = 0;
-  static uint8 effect9msg = 0;
-  static uint8 effectAmsg = 0;
+  int lo = 0, hi = MOD_NUM_NOTES - 1, mid;
+  uint32 tuned;
 
-  uint8 e, x, y, z;
-  for(channel = 0; channel < mod.number_channels; channel++)
-  {
-    x = mod.pattern[pattern][division][channel].argx;
-    y = mod.pattern[pattern][division][channel].argy;
-    e = mod.pattern[pattern][division][channel].effect;
+  if (!finetune || !period)
+    return(period);
 
-    switch (e)
-    {
-    case 0x0: case 0x1: case 0x2: case 0x3: case 0x4:
-      break;
-    default:
-      chan_state[channel].curr_samp_inc = chan_state[channel].div_samp_inc;
-      break;
-    }
+  /* note_period_0 goes down so the search is backwards                      */
+  while (lo <= hi)
+  {
+    mid = (lo + hi) >> 1;
+    if (note_period_0[mid] == period)
+      return(pl->note_period[finetune][mid]);
+    if (note_period_0[mid] > period)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
 
-    switch (e)
-    {
-    case 0x0:  /* Arpeggio */
-      if (!x && !y)
-      /* This will happen a lot...so there is a special case for efficiency  */
-      {
-        chan_state[channel].curr_samp_inc = chan_state[channel].div_samp_inc;
-        CLEARINCVOLFUN;
-        break;
-      }
+  tuned = (period * finetune_factor[finetune] + 0x8000) >> 16;
+  return((uint16) ((tuned < MOD_PERIOD_LIMIT) ? tuned : MOD_PERIOD_LIMIT - 1));
+}
 
-      /* As many calculations as possible are done apriori                   */
-      chan_state[channel].arpeggio_inc_a = chan_state[channel].div_samp_inc;
-      chan_state[channel].arpeggio_inc_b = (chan_state[channel].div_samp_inc 
-                                            * semitone_factor[x]) >> 13;
-      chan_state[channel].arpeggio_inc_c = (chan_state[channel].div_samp_inc
-                                            * semitone_factor[y]) >> 13; 
-      /* Calculate the three arpeggio frequencies; stored internally as the  */
-      /* increment amounts. We again leave them as 15 b.p. fixed point nums  */
-
-      chan_state[channel].arpeggio_one_third_div_pos = max_div_pos / 3;
-      chan_state[channel].arpeggio_two_third_div_pos = (max_div_pos << 1) / 3;
-      /* Calculate the Arpeggio position markers                             */
-      CLEARVOLFUN;
-      SETINCFUN(CalcArpeggioInc);
-      break;
 
-    case 0x1:  /* Slide/Portamento up */
-      /* Note: max period change per tick is 255.  min tick_buf_size is 39.  */
-      /* yielding a possible 6.54 period change per resample iteration.      */
-      /* This works out to a possible change in curr_samp_inc of 0.46 (max)  */
-      /* on a single iteration.  The max inc change in a tick is approx      */
-      /* 22.74.   A 22 b.p. fixed point was chosen (to be conservative)      */
-      /* With 32 ticks we could get an offset of approx 736                  */
 
-      if ((!x && !y) || !chan_state[channel].div_samp_inc)
-      /* problem, so don't do effect... but keep playing mod */
-      {
-        chan_state[channel].curr_samp_inc = chan_state[channel].div_samp_inc;
-        CLEARINCVOLFUN;
-        break;
-      }
-      z = (x << 4) + y;
-      chan_state[channel].slide_period = ((((AMIGA_CLOCK << 8) / out_rate)
-                  << 12) / (chan_state[channel].div_samp_inc << 1)) << 15;
-      chan_state[channel].slide_delta = (z << 20) / tick_buf_size;
+/* Gives the note nearest to (at or just above) period, the way Protracker   */
+/* looks it up for arpeggios and glissando                                   */
+int PeriodNote(const MPplayer* pl, uint16 period, uint8 finetune)
+{
+  int n;
 
-      CLEARVOLFUN;
-      SETINCFUN(CalcSlideUpInc);
+  for (n = 0; n < MOD_NUM_NOTES - 1; n++)
+    if (pl->note_period[finetune][n] <= period)
       break;
+  return(n);
+}
 
-    case 0x2:  /* Slide/Portamento down */
-      if ((!x && !y) || !chan_state[channel].div_samp_inc)
-      {
-        chan_state[channel].curr_samp_inc = chan_state[channel].div_samp_inc;
-        CLEARINCVOLFUN;
-        break;
-      }
-      z = (x << 4) + y;
-      chan_state[channel].slide_period = ((((AMIGA_CLOCK << 8) / out_rate)
-                  << 12) / (chan_state[channel].div_samp_inc << 1)) << 15;
-      /* should it be curr_samp_inc or div_samp_inc ??? */
 
-      chan_state[channel].slide_delta = (z << 20) / tick_buf_size;
 
-      CLEARVOLFUN;
-      SETINCFUN(CalcSlideDownInc);
-      break;
+/* Says whether this is the first time the player has run into the           */
+/* not-implemented effect bit (so whether to tell the user about it)         */
+int FirstWarning(MPplayer* pl, int bit)
+{
+  if (pl->fx_warned & (1UL << bit))
+    return(0);
+  pl->fx_warned |= 1UL << bit;
+  return(1);
+}
 
-    case 0x3:  /* Slide to Note/Tone-portamento */
-      if (!effect3msg)
-        printf("Slide to Note/Tone-portamento Not Implemented Yet. [%d,%d]\n"
-            ,x,y);
-      effect3msg = 1;
-      if (!x && !y) 
-        break; /* Leave the old vol/inc functions (and slide values)  active */
-      z = (x << 4) + y;
-      
-      CLEARINCVOLFUN;
-      break;
 
-    case 0x4:  /* Vibrato */
-      if (!effect4msg)
-        printf("Vibrato Not Implemented Yet.\n");
-      effect4msg = 1;
-      CLEARINCVOLFUN;
-      break;
 
-    case 0x5:  /* Slide to Note plus Volume Slide */
-      if (!effect5msg)
-        printf("Slide to Note plus Volume Slide Not Implemented Yet.\n");
-      effect5msg = 1;
-      CLEARINCVOLFUN;
-      break;
+/* Fills the tick buffer with the channel's clear_val from sample from on.   */
+/* The wider formats put in one sample, then copy what is there after        */
+/* itself until the tick is full.  A fade of clear_val still going (see      */
+/* FadeClearVal) comes first.                                                */
+void ClearTickBuffer(MPplayer* pl, struct chan_data* ch, uint32 from)
+{
+  uint32 size = OUTSIZE(pl->out_format);
+  uint32 total, done;
+  uint8* buf;
+  uint8 b;
+
+  if (ch->ramp_left)
+    from = FadeClearVal(pl, ch, from);
+  total = (pl->tick_buf_size - from) * size;
+  buf = pl->tick_buf + from * size;
+  if (!total)
+    return;
+  if (size == 1)
+  {
+    memcpy(&b, &ch->clear_val, sizeof(b));
+    memset(buf, b, total);
+    return;
+  }
+  memcpy(buf, &ch->clear_val, size);
+  for (done = size; done < total; done <<= 1)
+    memcpy(buf + done, buf, (done < total - done) ? done : total - done);
+}
 
-    case 0x6:  /* Vibrato plus Volume Slide */
-      if (!effect6msg)
-        printf("Vibrato plus Volume Slide Not Implemented Yet.\n");
-      effect6msg = 1;
-      CLEARINCVOLFUN;
-      break;
 
-    case 0x7:  /* Tremolo */
-      if (!effect7msg)
-        printf("Tremolo Not Implemented Yet.\n");
-      effect7msg = 1;
-      CLEARINCVOLFUN;
-      break;
 
-    case 0x8:  /* Not Used */
-      CLEARINCVOLFUN;
-      return(MP_BADEFFECT);
+/* With ramps on, a sample that ends leaves its last value (clear_val) to    */
+/* fade to silence over ramp_length samples: the value ramp_left from the    */
+/* end is clear_val * ramp_left / ramp_length.  Puts what is left of the     */
+/* fade in the tick buffer from sample from on and returns where it got to.  */
+/* At the end of the fade clear_val is silence.                              */
+uint32 FadeClearVal(MPplayer* pl, struct chan_data* ch, uint32 from)
+{
+  uint32 t = from, r = pl->ramp_length;
+  int16 w;
+  float f;
+  uint8 b;
+
+  if (ch->ramp_left > r)
+    ch->ramp_left = r;
+  switch (pl->out_format)
+  {
+  case MOD_OUT_UINT8:
+    memcpy(&b, &ch->clear_val, sizeof(b));
+    for (; ch->ramp_left && t < pl->tick_buf_size; t++, ch->ramp_left--)
+      pl->tick_buf[t] = (uint8) ((b * ch->ramp_left) / r);
+    break;
+  case MOD_OUT_INT16:
+    memcpy(&w, &ch->clear_val, sizeof(w));
+    for (; ch->ramp_left && t < pl->tick_buf_size; t++, ch->ramp_left--)
+      ((int16*) pl->tick_buf)[t] =
+        (int16) ((w * (int) ch->ramp_left) / (int) r);
+    break;
+  default:
+    memcpy(&f, &ch->clear_val, sizeof(f));
+    for (; ch->ramp_left && t < pl->tick_buf_size; t++, ch->ramp_left--)
+      ((float*) pl->tick_buf)[t] = f * ch->ramp_left / r;
+    break;
+  }
+  if (!ch->ramp_left)
+    ch->clear_val = 0;
+  return(t);
+}
 
-    case 0x9:  /* Set Sample Offset */
-      if (!effect9msg)
-        printf("Set Sample Offset Not Implemented Yet.\n");
-      effect9msg = 1;
-      CLEARINCVOLFUN;
-      break;
 
-    case 0xA:  /* Volume Slide */
-      if (!effectAmsg)
-        printf("Volume Slide Not Implemented Yet.\n");
-      effectAmsg = 1;
-      CLEARINCVOLFUN;
-      break;
 
-    case 0xB:  /* Position Jump.  NEEDS MORE TESTING */
-      CLEARINCVOLFUN;
-      if ((z = (x << 4) + y) < mod.length)
-      {
-        division = -1;
-        /* The - 1 is because after the current division is played the next  */
-        /* operation will be to increment the division counter.              */
-        song_pos = z;
-        pattern = mod.pattern_table[song_pos];
-      }
-      else
-        return(MP_BADJUMPEFFECT);
-      break;
+/* Adds length samples at from to those in buf, clipped as the format needs  */
+void AddTick(const MPplayer* pl, uint8* buf, const uint8* from,
+             uint32 length)
+{
+  uint32 t;
+  int w;
 
-    case 0xC:  /* Set Volume */
-      CLEARINCVOLFUN;
-      if ((z = (x << 4) + y) <= 64)
-        chan_state[channel].curr_samp_vol = z;
-      else
-        chan_state[channel].curr_samp_vol = 64;
-      break;
+  switch (pl->out_format)
+  {
+  case MOD_OUT_UINT8:
+    for (t = 0; t < length; t++)
+    {
+      w = buf[t] + from[t];
+      buf[t] = (uint8) ((w > 255) ? 255 : w);
+    }
+    break;
+  case MOD_OUT_INT16:
+    for (t = 0; t < length; t++)
+    {
+      w = ((int16*) buf)[t] + ((const int16*) from)[t];
+      ((int16*) buf)[t] =
+        (int16) ((w < -32768) ? -32768 : (w > 32767) ? 32767 : w);
+    }
+    break;
+  default:
+    for (t = 0; t < length; t++)
+      ((float*) buf)[t] += ((const float*) from)[t];
+    break;
+  }
+}
 
-    case 0xD:  /* Pattern Break */
-      CLEARINCVOLFUN;
-      /* Error checking should probably be implemented for this effect       */
-      /* Note that is there are multiple PB effects on different channels    */
-      /* we're in big trouble.  Should prob be fixed...                      */
-      if ((division = ((x * 10) + y - 1)) >= MOD_NUM_DIVISIONS)
-        return(MP_BADJUMPEFFECT);
-      /* The - 1 is because after the current division is played the next    */
-      /* operation will be to increment the division counter.                */
-
-      if (++song_pos >= mod.length) return(MP_BADJUMPEFFECT); 
-      /* if at the end we assume that the pattern table has no more info     */
-      pattern = mod.pattern_table[song_pos];
-      break;
 
-    case 0xE:  /* E Command */
-      ProcessEEffect(x, y);   /* should check return value here */
-      break;
 
-    case 0xF:  /* Set Speed */
-      if ((z = (x << 4) + y) < 32)
-      /* a different MOD spec says <= 32.  Make a command line flag choose.  */
-      {
-        if (!z) z = 1;
-        /* Treat z = 0 as z = 1.  Make a cl flag if we want this behaviour   */
-        tpd = z;
-      }
-      else
-        tick_buf_size = (5 * out_rate)/(z << 1);
-      max_div_pos = (tpd * tick_buf_size) - 1;
-      CLEARINCVOLFUN;
-      break;
+/* An effect block (PlayerSetEffectBlock) has a slide go from the period it  */
+/* played the tick before to this tick's over the tick, rather than all at   */
+/* once at its start: each span plays where the slide has got to by its end. */
+uint64 CalcGlideInc(const MPplayer* pl, struct chan_data* ch, int div_pos,
+                    int span)
+{
+  int from = ch->fx.glide_period, to = ch->play_period;
+  int size = (int) pl->tick_buf_size, end = div_pos % size + span;
 
-    default:  /* Can't imagine how this would happen. */
-      CLEARINCVOLFUN;
-      return(MP_BADEFFECT);
-    }
-  } 
-  return(MP_OK);
+  if (from < to)
+    return(pl->period_inc[from + (to - from) * end / size]);
+  return(pl->period_inc[from - (from - to) * end / size]);
 }
 
 
 
-void SetupChannels(void)
+/* CalcGlideInc for a volume slide                                           */
+uint32 CalcGlideVol(const MPplayer* pl, struct chan_data* ch, int div_pos,
+                    int span)
 {
-  uint16 period;
-  uint8 samp_no;
+  int from = ch->fx.glide_vol, to = ch->curr_samp_vol;
+  int size = (int) pl->tick_buf_size, end = div_pos % size + span;
+
+  if (from < to)
+    return((uint32) (from + (to - from) * end / size));
+  return((uint32) (from - (from - to) * end / size));
+}
+
+
 
-  /* initialize all the channels */
-  for (channel = 0; channel < mod.number_channels; channel++)
+/* The first tick of an E effect (see ProcessEffect)                         */
+MPstatus ProcessEEffect(MPplayer* pl, struct chan_data* ch, uint8 effect,
+                        uint8 x)
+{
+  switch (effect)
   {
-    period = mod.pattern[pattern][division][channel].period;
-    if ((samp_no = mod.pattern[pattern][division][channel].sample_number))
-      if ((chan_state[channel].sample_length =
-           mod.sample_desc[samp_no - 1].length) > 2)
-      {
-        chan_state[channel].sample = mod.sample[samp_no - 1];
-        chan_state[channel].curr_samp_vol =
-          mod.sample_desc[samp_no - 1].volume;
+  case 0x0:  /* Filter on/off.  Only heard with a PlayerSetFilter model */
+    pl->led = !(x & 1);   /* Protracker only looks at the bottom bit */
+    break;
 
-        chan_state[channel].sample_position = 0;
-        chan_state[channel].repeat_point =
-          mod.sample_desc[samp_no - 1].repeat_point;
+  case 0x1:  /* Fineslide up */
+    if (ch->period)
+      ch->period = (ch->period - x > MOD_SLIDE_MIN_PER) ?
+                   ch->period - x : MOD_SLIDE_MIN_PER;
+    break;
 
-        chan_state[channel].repeat_length =
-          mod.sample_desc[samp_no - 1].repeat_length;
-      }
-      else        /* goes with most recent 'if' (ANSI spec)                  */
-        chan_state[channel].sample = NULL;
-        /* Channel off (having a special case is more efficient) */
+  case 0x2:  /* Fineslide down */
+    if (ch->period)
+      ch->period = (ch->period + x < MOD_SLIDE_MAX_PER) ?
+                   ch->period + x : MOD_SLIDE_MAX_PER;
+    break;
 
-    else   /* no sample number */ 
-      if (period)
-        chan_state[channel].sample_position = 0;
-        /* This is what PT does if no sample is given but a period is        */
+  case 0x3:  /* Set Glissando: tone portamento plays whole notes */
+    ch->fx.glissando = x;
+    break;
 
-    /* Beware: The period must be set outside the last if. It must be set    */
-    /* regardless of whether there was a new sample. We use old sample rate  */
-    /* if period is 0                                                        */
+  case 0x4:  /* Set Vibrato Waveform (see fx_wave; with 4 added new notes */
+    ch->fx.vib_wave = x;     /* don't start it from the top again)        */
+    break;
 
-    if (period)
-      chan_state[channel].div_samp_inc =
-        (((AMIGA_CLOCK << 8) / ( period << 1)) << 7) / out_rate;
+  case 0x5:  /* Set Finetune.  Done by SetupNote, before the note is tuned */
+  case 0x6:  /* Patternloop.  Done by ProcessRow and NextRow */
+    break;
 
-    else
-      chan_state[channel].div_samp_inc = chan_state[channel].curr_samp_inc;
-    /* Lets presume the max value for samp_inc is 15...  This allows a       */
-    /* high max pitch (60KHz) and a min resampling rate of 4KHz              */
-  }
-}
+  case 0x7:  /* Set Tremolo Waveform (as E4x) */
+    ch->fx.trem_wave = x;
+    break;
 
+  case 0x8:  /* Invalid Effect */
+    return(MP_BADEFFECT);
 
+  case 0x9:  /* Retrigger Sample.  Done by TickEffect (and SetupNote) */
+    break;
 
-MPstatus PlayDivision(void)
-{
-  int tick;
-  void *t_buf;
+  case 0xA:  /* Fine Volume Slide up */
+    ch->volume = (ch->volume + x < 64) ? ch->volume + x : 64;
+    break;
 
-  /* Make sure mixer buffer is big enough to handle a whole ticks worth of   */
-  /* data.  No need to check return value from Mix then.                     */
-  /* Put in spec of mixer that this is guaranteed.  Add a way to query/set   */
-  /* the mixer buffer size upon initialization  i.e.it'll need to be dynamic */
+  case 0xB:  /* Fine Volume Slide down */
+    ch->volume = (ch->volume > x) ? ch->volume - x : 0;
+    break;
 
-  /* We do one tick at a time... allowing for a small mixer buffer size.     */
-  for (tick=0; tick < tpd; tick++)
-    for (channel = 0; channel < mod.number_channels; channel++)
-    {   
-      if ((chan_state[channel].sample)) /* && (channel == 1))   channel on */
-        ResampleTick(tick);
-      else
-        ClearTickBuffer();
-      t_buf = tick_buf;
-      Mix((1 << channel), &t_buf, tick_buf_size);
-    }
+  case 0xC:  /* Cut Sample.  Done by TickEffect unless it is now */
+    if (!x)
+      ch->volume = 0;
+    break;
+
+  case 0xD:  /* Delay Sample.  Done by SetupChannel and TickEffect */
+  case 0xE:  /* Delay Pattern.  Done by ProcessRow and PlayDivision */
+    break;
+
+  case 0xF:  /* Invert Loop.  It writes to the sample, which is read-only */
+    if (FirstWarning(pl, FX_WARN_E + 0xF))
+      printf("Invert Loop Not Implemented Yet.\n");
+    break;
+  }
   return(MP_OK);
 }
 
 
 
-MPstatus ResampleTick(int tick)
+/* Does the first tick of the effect of one event and notes the effect for   */
+/* the rest of the row's ticks (see TickEffect).  ch must be ev->channel's.  */
+/* The flow effects (B, D, E6x, EEx and F) have already been dealt with for  */
+/* the whole row by ProcessRow.                                              */
+MPstatus ProcessEffect(MPplayer* pl, struct chan_data* ch,
+                       const struct mod_event* ev)
 {
-  uint32 t, tc;
-  uint8* s;
-  uint32 l;
-  uint8 v, w = 0;
-  uint32 (*CCI) (int, int);
-  uint32 (*CCV) (int, int);
+  struct chan_fx* fx = &ch->fx;
+  uint8 x = ev->argx, y = ev->argy, z = ev->arg;
 
-  s = chan_state[channel].sample;
-  v = chan_state[channel].curr_samp_vol;
-  l = (chan_state[channel].repeat_length > 2) ? 
-       chan_state[channel].repeat_length + chan_state[channel].repeat_point :
-       chan_state[channel].sample_length;
-
-  for (t = 0; t < tick_buf_size; t++)
+  fx->effect = ev->effect;
+  fx->arg = z;
+  switch (ev->effect)
   {
-    CCI = chan_state[channel].CalcCurrInc;
-    if ((CCI = chan_state[channel].CalcCurrInc))
-      chan_state[channel].curr_samp_inc = (*CCI) (tick, t);
+  case 0x0:  /* Arpeggio */
+  case 0x1:  /* Slide/Portamento up */
+  case 0x2:  /* Slide/Portamento down */
+  case 0x5:  /* Slide to Note plus Volume Slide */
+  case 0x6:  /* Vibrato plus Volume Slide */
+  case 0xA:  /* Volume Slide */
+    break;   /* Nothing until the next tick */
+
+  case 0x3:  /* Slide to Note/Tone-portamento.  SetupNote sets the note */
+    if (z)
+      fx->porta_speed = z;
+    break;
 
-    if ((CCV = chan_state[channel].CalcCurrVol))
-      v = (*CCV) (tick, t);
+  case 0x4:  /* Vibrato.  An x or y of 0 keeps the last one */
+    if (x)
+      fx->vib_speed = x;
+    if (y)
+      fx->vib_depth = y;
+    break;
 
-    w = (s[ chan_state[channel].sample_position >> 15 ] * v) >> 6;
-    tick_buf[t] = w;
+  case 0x7:  /* Tremolo (as vibrato) */
+    if (x)
+      fx->trem_speed = x;
+    if (y)
+      fx->trem_depth = y;
+    break;
 
-    if (((chan_state[channel].sample_position +=
-          chan_state[channel].curr_samp_inc) >> 15) >= l)
-      if (chan_state[channel].repeat_length > 2)
-        chan_state[channel].sample_position =
-          chan_state[channel].repeat_point << 15;
-      else
-      {
-        /* Turn off channel for the rest of the ticks if sample completed    */
-        /* and we're not supposed to repeat.                                 */
-        chan_state[channel].clear_val = w;
-        chan_state[channel].sample = NULL;
-        break;
-      }
-  }
+  case 0x8:  /* Not Used */
+    fx->effect = fx->arg = 0;
+    return(MP_BADEFFECT);
+
+  case 0x9:  /* Set Sample Offset.  Done by SetupNote */
+  case 0xB:  /* Position Jump.  Done by ProcessRow and NextRow */
+  case 0xD:  /* Pattern Break.  Done by ProcessRow and NextRow */
+  case 0xF:  /* Set Speed.  Done by ProcessRow */
+    break;
 
-  /* The rest of the tick is empty.  Putting the previous value there seems  */
-  /* to get rid of the clicks.                                               */
-  for (tc = t; tc < tick_buf_size; tc++)
-    tick_buf[tc] = w;
+  case 0xC:  /* Set Volume */
+    ch->volume = (z <= 64) ? z : 64;
+    break;
+
+  case 0xE:  /* E Command */
+    return(ProcessEEffect(pl, ch, x, y));
 
+  default:  /* Can't imagine how this would happen. */
+    fx->effect = fx->arg = 0;
+    return(MP_BADEFFECT);
+  }
   return(MP_OK);
 }
 
 
 
-/* Presumes that the MOD file has been loaded and the mixer initialized with */
-/* the correct number of channels, 8bit resolution, and an arbitrary rate    */
-MPstatus PlayMod(void)
+/* Does the channel's effect for a tick after the first of its row, as       */
+/* Protracker does, and plays the result for the tick (see PlayTick).  tick  */
+/* counts from the start of the row (or of a repeat of it, with EEx).        */
+/* Only the channels in fx_active have anything to do.                       */
+void TickEffect(MPplayer* pl, struct chan_data* ch, int tick)
 {
+  struct chan_fx* fx = &ch->fx;
+  uint8 x = fx->arg >> 4, y = fx->arg & 0x0F;
+  int period = ch->period, vol = ch->volume, glide = 0, n;
 
-  /* I should check the return value                                         */
-  InitializePlayer();
-
-  for (song_pos = 0; song_pos < mod.length; song_pos++)
+  switch (fx->effect)
   {
-    pattern = mod.pattern_table[song_pos];
-    for (division = 0; division < MOD_NUM_DIVISIONS; division++)
+  case 0x0:  /* Arpeggio: the note, then x semitones up, then y */
+    if (tick % 3)
     {
-/*    printf("Pos:%3d   Pat:%3d   TPD:%3d   Div:%3d\r",
-              song_pos, pattern, tpd, division); */
-      fflush(NULL); 
-      SetupChannels();
+      n = PeriodNote(pl, ch->period, ch->finetune) +
+          ((tick % 3 == 1) ? x : y);
+      period = pl->note_period[ch->finetune]
+                              [(n < MOD_NUM_NOTES) ? n : MOD_NUM_NOTES - 1];
+    }
+    /* The notes above B-3 aren't in Protracker's tables; we stay at B-3.    */
+    break;
+
+  case 0x1:  /* Slide up, as far as MOD_SLIDE_MIN_PER */
+    if (ch->period)
+      period = ch->period = (period - fx->arg > MOD_SLIDE_MIN_PER) ?
+                            period - fx->arg : MOD_SLIDE_MIN_PER;
+    glide = FX_GLIDE_PERIOD;
+    break;
+
+  case 0x2:  /* Slide down, as far as MOD_SLIDE_MAX_PER */
+    if (ch->period)
+      period = ch->period = (period + fx->arg < MOD_SLIDE_MAX_PER) ?
+                            period + fx->arg : MOD_SLIDE_MAX_PER;
+    glide = FX_GLIDE_PERIOD;
+    break;
 
-      /* Do better checking of return value */
-      if (ProcessEffect() != MP_OK) break;
-      /* probably a bad jump occurred so we skip this division */
+  case 0x5:  /* Tone portamento plus volume slide */
+    vol = ch->volume = VolumeSlide(ch->volume, fx->arg);
+    glide = FX_GLIDE_VOL;
+    /* fall through */
+  case 0x3:  /* Tone portamento */
+    period = TonePortamento(pl, ch);
+    if (!fx->glissando)
+      glide |= FX_GLIDE_PERIOD;
+    break;
+
+  case 0x6:  /* Vibrato plus volume slide */
+    vol = ch->volume = VolumeSlide(ch->volume, fx->arg);
+    glide = FX_GLIDE_VOL;
+    /* fall through */
+  case 0x4:  /* Vibrato */
+    period += WaveDelta(fx->vib_wave, fx->vib_pos, fx->vib_depth, 7);
+    fx->vib_pos += fx->vib_speed << 2;
+    break;
+
+  case 0x7:  /* Tremolo */
+    vol += WaveDelta(fx->trem_wave, fx->trem_pos, fx->trem_depth, 6);
+    fx->trem_pos += fx->trem_speed << 2;
+    break;
+
+  case 0xA:  /* Volume slide */
+    vol = ch->volume = VolumeSlide(ch->volume, fx->arg);
+    glide = FX_GLIDE_VOL;
+    break;
 
-      PlayDivision();
+  case 0xE:
+    if (x == 0x9 && y && !(tick % y))               /* Retrigger */
+      StartNote(pl, ch, ch->note_start);
+    else if (x == 0xC && tick == y)                 /* Cut */
+      vol = ch->volume = 0;
+    else if (x == 0xD && tick == y && fx->delay_ev) /* Delay */
+    {
+      SetupNote(pl, ch, fx->delay_ev);
+      period = ch->period;
+      vol = ch->volume;
     }
+    break;
   }
-  return(MP_OK);
+  PlayTick(pl, ch, period, vol, glide);
 }
 
 
 
+/* Plays period and vol on the channel for the tick, clipped to what they    */
+/* can be.  glide says which of them a slide has moved: with an effect block */
+/* those get there from the last tick's over the tick (see CalcGlideInc).    */
+void PlayTick(const MPplayer* pl, struct chan_data* ch, int period, int vol,
+              int glide)
+{
+  if (!ch->period)
+    period = 0;
+  else if (period < 1)
+    period = 1;
+  else if (period >= MOD_PERIOD_LIMIT)
+    period = MOD_PERIOD_LIMIT - 1;
+  vol = (vol < 0) ? 0 : (vol > 64) ? 64 : vol;
+
+  ch->fx.glide_period = ch->play_period;
+  ch->fx.glide_vol = ch->curr_samp_vol;
+  ch->play_period = (uint16) period;
+  ch->curr_samp_inc = pl->period_inc[period];
+  ch->curr_samp_vol = (uint8) vol;
+  CLEARINCVOLFUN(ch);
+  if (pl->fx_block)
+  {
+    if ((glide & FX_GLIDE_PERIOD) && ch->fx.glide_period != period)
+      SETINCFUN(ch, CalcGlideInc);
+    if ((glide & FX_GLIDE_VOL) && ch->fx.glide_vol != vol)
+      SETVOLFUN(ch, CalcGlideVol);
+  }
+}
+
+
+
+/* Slides the note's period a tick's worth (3xx's speed) towards the note    */
+/* that 3xx or 5xy was given, and gives the period to play: with glissando   */
+/* on, the note the slide has got to.                                        */
+uint16 TonePortamento(const MPplayer* pl, struct chan_data* ch)
+{
+  struct chan_fx* fx = &ch->fx;
+  int p = ch->period, target = fx->porta_target;
+
+  if (p && target)
+  {
+    if (p > target)
+      p = (p - fx->porta_speed > target) ? p - fx->porta_speed : target;
+    else
+      p = (p + fx->porta_speed < target) ? p + fx->porta_speed : target;
+    if (p == target)
+      fx->porta_target = 0;
+    ch->period = (uint16) p;
+  }
+  if (fx->glissando && p)
+    return(pl->note_period[ch->finetune]
+                          [PeriodNote(pl, (uint16) p, ch->finetune)]);
+  return((uint16) p);
+}
+
+
+
+/* Slides vol up by the top half of arg or, if that is 0, down by the bottom */
+uint8 VolumeSlide(uint8 vol, uint8 arg)
+{
+  if (arg >> 4)
+    return((uint8) ((vol + (arg >> 4) < 64) ? vol + (arg >> 4) : 64));
+  return((uint8) ((vol > (arg & 0x0F)) ? vol - (arg & 0x0F) : 0));
+}
+
+
+
+/* Protracker's vibrato (shift 7) or tremolo (shift 6) of depth at pos in    */
+/* the wave's cycle.  Its size is rounded down before it is given a sign.    */
+int WaveDelta(uint8 wave, uint8 pos, uint8 depth, int shift)
+{
+  int w = FXWAVE(wave, pos);
+
+  return((w < 0) ? -((-w * depth) >> shift) : (w * depth) >> shift);
+}
+
+
+
+/* Starts the note (if any) of one event or, with a note delay (EDx),        */
+/* leaves it for TickEffect to start on tick x.  ch must be ev->channel's.   */
+void SetupChannel(MPplayer* pl, struct chan_data* ch,
+                  const struct mod_event* ev)
+{
+  ch->fx.delay_ev = NULL;
+  if (ev->effect == 0xE && ev->argx == 0xD && ev->argy)
+    ch->fx.delay_ev = ev;
+  else
+    SetupNote(pl, ch, ev);
+}
+
+
+
+/* Starts the note (if any) of one event.  A note with a tone portamento     */
+/* (3xx or 5xy) isn't started: it is where the slide goes.  A sample number  */
+/* sets the volume and finetune, and starts the sample even with no period.  */
+void SetupNote(MPplayer* pl, struct chan_data* ch, const struct mod_event* ev)
+{
+  const struct mod_samp_desc* desc;
+  uint16 period = ev->period;
+  uint8 e = ev->effect;
+  int porta = (e == 0x3) || (e == 0x5);
+
+  if (ev->sample_number)
+  {
+    desc = &pl->mod->sample_desc[ev->sample_number - 1];
+    ch->volume = desc->volume;
+    ch->finetune = desc->finetune;
+    if (!porta)
+      ch->instrument = ev->sample_number;
+  }
+  if (e == 0xE && ev->argx == 0x5)  /* Set Finetune, from this note on */
+    ch->finetune = ev->argy;
+  if (e == 0x9 && ev->arg)          /* A sample offset of 0 is the last one */
+    ch->fx.offset = ev->arg;
+
+  /* Beware: The period must be set outside the sample's if.  We use the     */
+  /* old period if there is none.                                            */
+  if (period)
+  {
+    period = TunePeriod(pl, period, ch->finetune);
+    if (porta)
+    {
+      ch->fx.porta_target = period;
+      return;
+    }
+    ch->period = period;
+    if (!(ch->fx.vib_wave & 4))
+      ch->fx.vib_pos = 0;
+    if (!(ch->fx.trem_wave & 4))
+      ch->fx.trem_pos = 0;
+  }
+
+  if ((ev->sample_number && !porta) || period)
+    StartNote(pl, ch, (e == 0x9) ? (uint32) ch->fx.offset << 8 : 0);
+  else if (e == 0xE && ev->argx == 0x9 && ev->argy)
+    StartNote(pl, ch, ch->note_start);  /* E9x retriggers on tick 0 too */
+}
+
+
+
+/* (Re)starts the channel's instrument at sample start.  A start past the    */
+/* end (9xx) goes straight to the loop, or to silence if there is none.      */
+/* With ramps on the note it was playing fades out (see RampNote).           */
+void StartNote(MPplayer* pl, struct chan_data* ch, uint32 start)
+{
+  const struct mod_samp_desc* desc;
+  const struct mod_prep_sample* prep;
+  uint8 samp_no = ch->instrument;
+
+  if (pl->ramp_length)
+    RampNote(pl, ch);
+
+  /* Channel off (having a special case is more efficient)                   */
+  ch->sample = NULL;
+  if (!samp_no)
+    return;
+  desc = &pl->mod->sample_desc[samp_no - 1];
+  if ((ch->sample_length = desc->length) <= 2)
+    return;
+  ch->sample = ModGetSample(pl->module, samp_no - 1);
+  ch->repeat_point = desc->repeat_point;
+  ch->repeat_length = desc->repeat_length;
+
+  /* The copy's loop has been checked against the data, so it is the one     */
+  /* played                                                                  */
+  ch->prep = NULL;
+  if (interp_kernel[pl->interp_kernel].Interpolate &&
+      (prep = ModGetPrepared(pl->module, MOD_PREP_INT16, samp_no - 1)))
+  {
+    ch->prep = (const int16*) prep->data;
+    ch->sample_length = prep->length;
+    ch->repeat_point = prep->loop_start;
+    ch->repeat_length = prep->loop_length;
+  }
+
+  ch->note_start = start;
+  if (start >= SAMPLEEND(ch))
+  {
+    if (ch->repeat_length <= 2)
+    {
+      ch->sample = NULL;
+      return;
+    }
+    start = ch->repeat_point;
+  }
+  ch->sample_position = INDEXPOS(start);
+}
+
+
+
+/* With ramps on, a note that starts (or a cut) hands the note the channel   */
+/* is playing to its ghost, which fades it out over the ramp, and the new    */
+/* one fades in from silence.  A ghost still fading from before is cut       */
+/* short.  In Paula mode the ghost goes on for the residuals of its last     */
+/* steps, and takes its filters with it but for the slow high pass.          */
+void RampNote(MPplayer* pl, struct chan_data* ch)
+{
+  struct chan_data* g = GHOST(pl, ch);
+  int r = (int) pl->ramp_length;
+
+  if (ch->sample && ch->ramp_vol)
+  {
+    *g = *ch;
+    CLEARINCVOLFUN(g);
+    g->ramp_target = 0;
+    g->ramp_step = -((g->ramp_vol + r - 1) / r);
+    g->ramp_left = r;
+    if (pl->interp_kernel == MOD_INTERP_PAULA)
+      g->ramp_left += PAULA_BLEP_TAPS;
+    PaulaHandOverFilter(&g->filter, &ch->filter);
+  }
+  else
+    PaulaSettleFilter(&ch->filter, 0);
+
+  ch->ramp_vol = 0;
+  ch->ramp_target = 0;
+  ch->ramp_left = 0;
+  ch->clear_val = 0;
+  ch->blep_level = 0;
+  memset(ch->blep_carry, 0, sizeof(ch->blep_carry));
+}
+
+
+
+/* Sets up the current division and plays its first tick's notes.  Only      */
+/* the channels with an event in this row are looked at: an empty cell       */
+/* just means "no effect", so a channel without an event only needs its      */
+/* effect stopped, and fx_active says which ones have one to stop.           */
+MPstatus ProcessRow(MPplayer* pl, const struct mod_row* row)
+{
+  const struct mod_event* ev = pl->mod->event + row->first_event;
+  const struct mod_event* end = ev + row->number_events;
+  struct chan_data* ch;
+  uint32 stale = pl->fx_active;
+  MPstatus status = MP_OK;
+
+  /* Speed and tempo hold for the whole row so they are done first           */
+  if (row->flags & MOD_ROW_SPEED)
+    pl->tpd = row->speed;
+  if (row->flags & MOD_ROW_TEMPO)
+    pl->tick_buf_size = MODTICKSIZE(pl->out_rate, row->tempo);
+  pl->row_ticks = pl->tpd *
+                  (((row->flags & MOD_ROW_DELAY) ? row->delay : 0) + 1);
+
+  pl->fx_active = 0;
+  for (; ev < end; ev++)
+  {
+    ch = &pl->chan_state[ev->channel];
+    stale &= ~(1UL << ev->channel);
+    SetupChannel(pl, ch, ev);
+    status |= ProcessEffect(pl, ch, ev);
+    if (FXTICKS(&ch->fx))
+      pl->fx_active |= 1UL << ev->channel;
+    PlayTick(pl, ch, ch->period, ch->volume, 0);
+  }
+
+  for (ch = pl->chan_state; stale; ch++, stale >>= 1)
+    if (stale & 1)
+    {
+      ch->fx.effect = ch->fx.arg = 0;
+      PlayTick(pl, ch, ch->period, ch->volume, 0);
+    }
+
+  if (row->flags & MOD_ROW_BADJUMP)
+    return(MP_BADJUMPEFFECT);
+  return(status);
+}
+
+
+
+MPstatus PlayDivision(MPplayer* pl, int silent)
+{
+  int tick, channel;
+  struct chan_data* ch;
+  struct chan_data* g;
+  void *t_buf;
+  void *s_buf;
+  uint32 skip;
+
+  /* Make sure mixer buffer is big enough to handle a whole ticks worth of   */
+  /* data.  No need to check return value from Mix then.                     */
+  /* Put in spec of mixer that this is guaranteed.  Add a way to query/set   */
+  /* the mixer buffer size upon initialization  i.e.it'll need to be dynamic */
+
+  /* We do one tick at a time... allowing for a small mixer buffer size.     */
+  /* Silent (or skipped) ticks only move the channels on.  The tick with     */
+  /* the end of a skip in it is made and the part after the skip is sent.    */
+  /* Each tick after the first does the effects first (see TickEffect).      */
+  /* A channel that is quiet for the tick is moved on in the same way, and   */
+  /* the sinks get a NULL tick, which they take as silence.                  */
+  for (tick=0; tick < (int) pl->row_ticks; tick++)
+  {
+    if (pl->fade_left)
+      pl->fade_gain =
+        (uint32) (((uint64) pl->fade_left << 16) / pl->fade_length);
+    skip = (pl->skip_samples < pl->tick_buf_size) ?
+            pl->skip_samples : pl->tick_buf_size;
+    for (channel = 0; channel < pl->mod->number_channels; channel++)
+    {   
+      ch = &pl->chan_state[channel];
+      g = GHOST(pl, ch);
+      if (tick && (pl->fx_active & (1UL << channel)))
+        TickEffect(pl, ch, tick % pl->tpd);
+      if (silent || skip == pl->tick_buf_size)
+      {
+        if (ch->sample)
+          ResampleTick(pl, ch, tick, NULL);
+        else if (ch->ramp_left)
+          ClearTickBuffer(pl, ch, 0);   /* to move its fade on */
+        if (g->sample)
+          GhostTick(pl, g, NULL);
+        continue;
+      }
+      if (QuietTick(pl, ch))
+      {
+        if (ch->sample)
+          ResampleTick(pl, ch, tick, NULL);
+        t_buf = NULL;
+      }
+      else
+      {
+        if ((ch->sample)) /* && (channel == 1))   channel on */
+          ResampleTick(pl, ch, tick, pl->tick_buf);
+        else
+          ClearTickBuffer(pl, ch, 0);
+        if (g->sample)
+          GhostTick(pl, g, pl->tick_buf);
+        t_buf = pl->tick_buf + skip * OUTSIZE(pl->out_format);
+      }
+      if (pl->stem_sink)
+      {
+        s_buf = t_buf;
+        (*pl->stem_sink)(pl->stem_data, MixerGetChanID(channel), &s_buf,
+                         pl->tick_buf_size - skip);
+      }
+      (*pl->sink)(pl->sink_data, MixerGetChanID(channel), &t_buf,
+                  pl->tick_buf_size - skip);
+    }
+    pl->skip_samples -= skip;
+    pl->sample_pos += pl->tick_buf_size;
+
+    /* A fade ends the song at the end of its last tick                      */
+    if (pl->fade_left)
+    {
+      if (pl->fade_left <= pl->tick_buf_size)
+      {
+        pl->fade_left = 0;
+        pl->ended = 1;
+        break;
+      }
+      pl->fade_left -= pl->tick_buf_size;
+    }
+  }
+  return(MP_OK);
+}
+
+
+
+/* Whether all the channel would make this tick is 0s: there is no sample    */
+/* and what it left has died away, or the sample is at a volume of 0 with    */
+/* no ramp going or to come.  Nothing of the note can be left behind then,   */
+/* so moving it on without making it (see SkipSpan) leaves it exactly as     */
+/* playing would.  Paula mode is never quiet with a sample, as a step's      */
+/* residual and the filters go on ringing.                                   */
+int QuietTick(const MPplayer* pl, struct chan_data* ch)
+{
+  uint32 v = ch->curr_samp_vol;
+
+  if (GHOST(pl, ch)->sample || ch->ramp_left)
+    return(0);
+  if (!ch->sample)
+    return(!ch->clear_val);
+  if (pl->interp_kernel == MOD_INTERP_PAULA || ch->CalcCurrVol)
+    return(0);
+  if (pl->fade_left)
+    v = (v * pl->fade_gain) >> 16;
+  return(!v && (!pl->ramp_length || !ch->ramp_target));
+}
+
+
+
+/* The tick is cut into spans of fx_block samples (or one span if it is 0).  */
+/* The effects are worked out once per span, which leaves ResampleSpan a     */
+/* plain loop with a fixed increment and volume.  With ramps on, a span      */
+/* whose volume has changed starts a ramp to it, and while that runs the     */
+/* span is cut again into RAMP_BLOCKs, each at the ramp's volume.  With no   */
+/* buf the channel is only moved on (see SkipSpan).                          */
+MPstatus ResampleTick(MPplayer* pl, struct chan_data* ch, int tick,
+                      uint8* buf)
+{
+  uint32 t, n, done, span, next = 0, l = SAMPLEEND(ch);
+  uint32 div_pos = tick * pl->tick_buf_size;
+  int size = OUTSIZE(pl->out_format);
+  uint8 v, fv = 0, vol;
+
+  v = ch->curr_samp_vol;
+  span = (pl->fx_block && pl->fx_block < pl->tick_buf_size) ?
+          pl->fx_block : pl->tick_buf_size;
+
+  for (t = 0; t < pl->tick_buf_size; t += done)
+  {
+    if (t == next)
+    {
+      n = pl->tick_buf_size - t;
+      if (n > span)
+        n = span;
+      next = t + n;
+
+      if (ch->CalcCurrInc)
+        ch->curr_samp_inc = (*ch->CalcCurrInc) (pl, ch, div_pos + t, n);
+      if (ch->CalcCurrVol)
+        v = (*ch->CalcCurrVol) (pl, ch, div_pos + t, n);
+      fv = pl->fade_left ? (uint8) ((v * pl->fade_gain) >> 16) : v;
+      if (pl->ramp_length && fv != ch->ramp_target)
+      {
+        ch->ramp_target = fv;
+        ch->ramp_step = ((fv << 16) - ch->ramp_vol) / (int) pl->ramp_length;
+        ch->ramp_left = pl->ramp_length;
+      }
+    }
+    n = next - t;
+    vol = ch->ramp_left ? RampBlock(ch, &n) : fv;
+
+    done = PlaySpan(pl, ch, buf ? buf + t * size : NULL, n, vol, l);
+    if (!ch->sample)
+    {
+      /* The rest of the tick is empty.  Putting the previous value there    */
+      /* seems to get rid of the clicks.  With ramps on it fades out.        */
+      ch->ramp_left = pl->ramp_length;
+      if (buf || ch->ramp_left)
+        ClearTickBuffer(pl, ch, t + done);
+      break;
+    }
+  }
+
+  return(MP_OK);
+}
+
+
+
+/* Plays what is left of a ghost's fade (or the tick, if that is less)       */
+/* into ramp_buf and adds it to buf.  With no buf it is only moved on.  It   */
+/* is gone at the end of the fade or of its sample.                          */
+void GhostTick(MPplayer* pl, struct chan_data* g, uint8* buf)
+{
+  uint8* out = buf ? pl->ramp_buf : NULL;
+  uint32 t, n, length, l = SAMPLEEND(g);
+  int size = OUTSIZE(pl->out_format);
+  uint8 vol;
+
+  length = (g->ramp_left < pl->tick_buf_size) ?
+            g->ramp_left : pl->tick_buf_size;
+  for (t = 0; t < length && g->sample; t += n)
+  {
+    n = length - t;
+    vol = RampBlock(g, &n);
+    n = PlaySpan(pl, g, out ? out + t * size : NULL, n, vol, l);
+  }
+  if (buf)
+    AddTick(pl, buf, out, t);
+  if (!g->ramp_left)
+    g->sample = NULL;
+}
+
+
+
+/* Makes length samples of the channel in buf at vol with the player's       */
+/* kernel, or with no buf moves it on as that kernel would.  Returns the     */
+/* number done (see ResampleSpan).                                           */
+uint32 PlaySpan(const MPplayer* pl, struct chan_data* ch, uint8* buf,
+                uint32 length, uint8 vol, uint32 end)
+{
+  if (pl->interp_kernel == MOD_INTERP_PAULA)
+    return(buf ? BlepSpan(pl, ch, buf, length, vol, end) :
+                 SkipBlep(pl, ch, length, vol, end));
+  if (!buf)
+    return(SkipSpan(pl, ch, length, vol, end));
+  if (INTERPOLATING(pl, ch))
+    return(InterpSpan(pl, ch, buf, length, vol, end));
+  return(ResampleSpan(pl, ch, buf, length, vol, end));
+}
+
+
+
+/* Cuts *length down to the next block of the channel's ramp and moves the   */
+/* ramp on over it.  The block is played at the ramp's volume at its middle. */
+/* At the end of the ramp the volume is exactly the target.                  */
+uint8 RampBlock(struct chan_data* ch, uint32* length)
+{
+  int from = ch->ramp_vol, target = ch->ramp_target << 16;
+
+  if (*length > RAMP_BLOCK)
+    *length = RAMP_BLOCK;
+  if (*length > ch->ramp_left)
+    *length = ch->ramp_left;
+  ch->ramp_vol += ch->ramp_step * (int) *length;
+  if (!(ch->ramp_left -= *length) ||
+      ((ch->ramp_step < 0) ? ch->ramp_vol < target : ch->ramp_vol > target))
+    ch->ramp_vol = target;
+  return((uint8) ((from + ch->ramp_vol + (1 << 16)) >> 17));
+}
+
+
+
+/* How many steps at inc it takes pos to get to (or past) end, which is the  */
+/* number of output samples until the sample (or its loop) ends, counting    */
+/* the one it ends after.  Anything over most (as an inc of 0 is) is most.   */
+uint32 StepsToEnd(uint64 pos, uint64 inc, uint32 end, uint32 most)
+{
+  uint64 limit = INDEXPOS(end);
+
+  if (pos >= limit)
+    return(1);
+  if (!inc || (limit - pos - 1) / inc >= most)
+    return(most);
+  return((uint32) ((limit - pos - 1) / inc) + 1);
+}
+
+
+
+/* Resamples length samples of the channel into buf at its current           */
+/* increment and volume.  end is where the sample (or its loop) ends.        */
+/* Returns the number of samples done, which is less than length only if     */
+/* the sample has ended and doesn't repeat (then ch->sample is NULL).        */
+/* The span is played as runs up to the end of the sample, each in a loop    */
+/* (one for each output format) with no checks, and the loop or end of the   */
+/* sample is dealt with once between them.                                   */
+uint32 ResampleSpan(const MPplayer* pl, struct chan_data* ch, uint8* buf,
+                    uint32 length, uint8 vol, uint32 end)
+{
+  const int8* s = ch->sample;
+  uint64 pos = ch->sample_position;
+  uint64 inc = ch->curr_samp_inc;
+  int vol8 = vol << 8, size = OUTSIZE(pl->out_format);
+  uint32 t, i, n, steps;
+
+  for (t = 0; t < length; )
+  {
+    steps = StepsToEnd(pos, inc, end, length - t + 1);
+    n = (steps > length - t) ? length - t : steps;
+
+    switch (pl->out_format)
+    {
+    case MOD_OUT_UINT8:
+      RESAMPLERUN((buf + t),
+                  (SAMPLETOUNSIGNED(s[POSINDEX(pos)]) * vol) >> 6);
+      break;
+    case MOD_OUT_INT16:
+      RESAMPLERUN(((int16*) buf + t), OUTINT16(s[POSINDEX(pos)] * vol8));
+      break;
+    default:
+      RESAMPLERUN(((float*) buf + t), OUTFLOAT(s[POSINDEX(pos)] * vol8));
+      break;
+    }
+    t += n;
+    if (n < steps)
+      break;
+
+    /* The run ended the sample.  The channel is turned off for the rest of  */
+    /* the ticks unless it is supposed to repeat.                            */
+    if (ch->repeat_length > 2)
+      pos = INDEXPOS(ch->repeat_point);
+    else
+    {
+      memcpy(&ch->clear_val, buf + (t - 1) * size, size);
+      ch->sample = NULL;
+      break;
+    }
+  }
+
+  ch->sample_position = pos;
+  return(t);
+}
+
+
+
+/* Moves the channel on by length samples exactly as ResampleSpan would,     */
+/* without making them, and returns the same.  Rather than stepping sample   */
+/* by sample it goes to the end of the sample in one go.  Every time round   */
+/* a loop starts from repeat_point and takes the same number of steps, so    */
+/* the whole turns of it are taken off at once.                              */
+uint32 SkipSpan(const MPplayer* pl, struct chan_data* ch, uint32 length,
+                uint8 vol, uint32 end)
+{
+  uint64 pos = ch->sample_position;
+  uint64 inc = ch->curr_samp_inc;
+  uint32 steps, turn, left = length;
+
+  while (left)
+  {
+    steps = StepsToEnd(pos, inc, end, left + 1);
+    if (steps > left)
+    {
+      pos += inc * left;
+      left = 0;
+      break;
+    }
+    pos += inc * (steps - 1);
+    left -= steps;
+
+    if (ch->repeat_length > 2)
+    {
+      pos = INDEXPOS(ch->repeat_point);
+      if ((turn = StepsToEnd(pos, inc, end, left + 1)) <= left)
+        left %= turn;
+    }
+    else
+    {
+      if (INTERPOLATING(pl, ch))
+        (*interp_kernel[pl->interp_kernel].Interpolate)
+          (ch->prep, pl->interp_table, pos, inc, 1, vol, pl->out_format,
+           (uint8*) &ch->clear_val);
+      else
+        StoreLevel(pl->out_format, (uint8*) &ch->clear_val,
+                   ch->sample[POSINDEX(pos)] * (vol << 8), vol);
+      ch->sample = NULL;
+      pos += inc;
+      break;
+    }
+  }
+
+  ch->sample_position = pos;
+  return(length - left);
+}
+
+
+
+/* ResampleSpan for Paula mode.  The channel is a level that steps to each   */
+/* sample as the position gets to it (and to a new note or volume straight   */
+/* away), and each step goes in as a minBLEP (see ptpaula.h) at the point    */
+/* between two outputs where it falls.  The residuals are summed in          */
+/* paula_buf; those reaching past the span are carried to the next one.      */
+uint32 BlepSpan(const MPplayer* pl, struct chan_data* ch, uint8* buf,
+                uint32 length, uint8 vol, uint32 end)
+{
+  const int8* s = ch->sample;
+  int* acc = pl->paula_buf;
+  int* y = pl->paula_buf + pl->max_tick + PAULA_BLEP_TAPS;
+  uint64 pos = ch->sample_position;
+  uint64 inc = ch->curr_samp_inc;
+  uint32 t, idx, phase;
+  uint64 next, npos, recip;
+  int level = ch->blep_level, w;
+
+  memcpy(acc, ch->blep_carry, sizeof(ch->blep_carry));
+  memset(acc + PAULA_BLEP_TAPS, 0, length * sizeof(int));
+  /* A step is less than inc before npos, so the phase's product is less     */
+  /* than 2^54                                                               */
+  recip = inc ? ((uint64) PAULA_BLEP_PHASES << 48) / inc : 0;
+
+  if ((w = s[POSINDEX(pos)] * vol) != level)
+  {
+    PaulaAddStep(pl->interp_table, w - level, 0, acc);
+    level = w;
+  }
+
+  next = INDEXPOS(POSINDEX(pos) + 1);
+  for (t = 0; t < length; )
+  {
+    y[t] = BLEPLEVEL(level) - acc[t];
+
+    /* The steps between this output and the next, as ResampleSpan moves     */
+    for (npos = pos + inc; next <= npos; )
+    {
+      phase = (uint32) (((npos - next) * recip) >> 48);
+      if (phase >= PAULA_BLEP_PHASES)
+        phase = PAULA_BLEP_PHASES - 1;
+      if ((idx = POSINDEX(next)) >= end)
+      {
+        if (ch->repeat_length <= 2)
+        {
+          ch->sample = NULL;
+          break;
+        }
+        idx = ch->repeat_point;
+        npos = INDEXPOS(idx);
+        next = npos;
+      }
+      next += INDEXPOS(1);
+      w = s[idx] * vol;
+      PaulaAddStep(pl->interp_table, w - level, phase, acc + t + 1);
+      level = w;
+    }
+    pos = npos;
+    t++;
+    if (!ch->sample)
+      break;
+  }
+
+  ch->sample_position = pos;
+  ch->blep_level = level;
+  memcpy(ch->blep_carry, acc + t, sizeof(ch->blep_carry));
+
+  if (pl->filter.model != MOD_FILTER_NONE)
+    PaulaFilter(&pl->filter, &ch->filter, pl->led, y, t);
+
+  /* The levels are on the scale of the OUT macros, less the clipping        */
+  switch (pl->out_format)
+  {
+  case MOD_OUT_UINT8:
+    for (idx = 0; idx < t; idx++)
+    {
+      w = (y[idx] + (vol << 15)) >> 14;
+      buf[idx] = (uint8) ((w < 0) ? 0 : (w > 255) ? 255 : w);
+    }
+    break;
+  case MOD_OUT_INT16:
+    for (idx = 0; idx < t; idx++)
+    {
+      w = y[idx] >> 6;
+      ((int16*) buf)[idx] =
+        (int16) ((w < -32768) ? -32768 : (w > 32767) ? 32767 : w);
+    }
+    break;
+  default:
+    for (idx = 0; idx < t; idx++)
+      ((float*) buf)[idx] = OUTFLOAT(y[idx]);
+    break;
+  }
+  if (!ch->sample)
+    memcpy(&ch->clear_val, buf + (t - 1) * OUTSIZE(pl->out_format),
+           OUTSIZE(pl->out_format));
+  return(t);
+}
+
+
+
+/* SkipSpan for Paula mode.  Only the steps in the last PAULA_BLEP_TAPS      */
+/* samples reach past the span, so the samples before those are just moved   */
+/* over and the rest are made (into the tick buffer, which isn't in use).    */
+/* A sample that ends is made from PAULA_BLEP_TAPS before its last output,   */
+/* which gives the clear_val.  The filters can't be moved over like that:    */
+/* they are left settled on the channel's level.                             */
+uint32 SkipBlep(const MPplayer* pl, struct chan_data* ch, uint32 length,
+                uint8 vol, uint32 end)
+{
+  uint32 skip, steps;
+
+  skip = (length > PAULA_BLEP_TAPS) ? length - PAULA_BLEP_TAPS : 0;
+  if (ch->repeat_length <= 2)
+  {
+    steps = StepsToEnd(ch->sample_position, ch->curr_samp_inc, end,
+                       length + 1);
+    if (steps < skip + PAULA_BLEP_TAPS + 1)
+      skip = (steps > PAULA_BLEP_TAPS + 1) ? steps - PAULA_BLEP_TAPS - 1 : 0;
+  }
+
+  if (skip)
+  {
+    SkipSpan(pl, ch, skip, vol, end);
+    ch->blep_level = ch->sample[POSINDEX(ch->sample_position)] * vol;
+    memset(ch->blep_carry, 0, sizeof(ch->blep_carry));
+  }
+  PaulaSettleFilter(&ch->filter, BLEPLEVEL(ch->blep_level));
+  return(skip + BlepSpan(pl, ch, pl->tick_buf, length - skip, vol, end));
+}
+
+
+
+/* ResampleSpan for the interpolating kernels.  The kernel is handed runs    */
+/* that stop short of the end of the sample (or loop), so it has no checks   */
+/* of its own in its loop.                                                   */
+uint32 InterpSpan(const MPplayer* pl, struct chan_data* ch, uint8* buf,
+                  uint32 length, uint8 vol, uint32 end)
+{
+  const struct interp_kernel* k = &interp_kernel[pl->interp_kernel];
+  uint64 pos = ch->sample_position;
+  uint64 inc = ch->curr_samp_inc;
+  uint32 t = 0, steps;
+  int size = OUTSIZE(pl->out_format);
+
+  while (t < length)
+  {
+    steps = StepsToEnd(pos, inc, end, length - t + 1);
+    if (steps > length - t)
+    {
+      (*k->Interpolate)(ch->prep, pl->interp_table, pos, inc, length - t,
+                        vol, pl->out_format, buf + t * size);
+      pos += inc * (length - t);
+      t = length;
+      break;
+    }
+    (*k->Interpolate)(ch->prep, pl->interp_table, pos, inc, steps, vol,
+                      pl->out_format, buf + t * size);
+    pos += inc * (steps - 1);
+    t += steps;
+
+    if (ch->repeat_length > 2)
+      pos = INDEXPOS(ch->repeat_point);
+    else
+    {
+      memcpy(&ch->clear_val, buf + (t - 1) * size, size);
+      ch->sample = NULL;
+      pos += inc;
+      break;
+    }
+  }
+
+  ch->sample_position = pos;
+  return(t);
+}
+
+
+
+/* The plain C kernel: any number of taps, one sample at a time.  It is      */
+/* what the others fall back on without SSE2 and for their last few.         */
+void InterpTaps(const int16* s, const int16* table, int taps, uint64 pos,
+                uint64 inc, uint32 length, uint8 vol, int format, uint8* buf)
+{
+  const int16* p;
+  const int16* c;
+  int y, k;
+
+  for (; length; length--, pos += inc)
+  {
+    p = s + POSINDEX(pos) - (taps / 2 - 1);
+    c = table + INTERPPHASE(pos) * taps;
+    for (y = 0, k = 0; k < taps; k++)
+      y += p[k] * c[k];
+    y >>= INTERP_SHIFT;
+    if (y > 32767)
+      y = 32767;
+    else if (y < -32768)
+      y = -32768;
+    StoreLevel(format, buf, y * vol, vol);
+    buf += OUTSIZE(format);
+  }
+}
+
+
+
+/* Puts one level (see OUTUINT8) in buf in format                            */
+void StoreLevel(int format, uint8* buf, int level, uint8 vol)
+{
+  int16 w;
+  float f;
+
+  switch (format)
+  {
+  case MOD_OUT_UINT8:
+    *buf = OUTUINT8(level, vol);
+    break;
+  case MOD_OUT_INT16:
+    w = OUTINT16(level);
+    memcpy(buf, &w, sizeof(w));
+    break;
+  default:
+    f = OUTFLOAT(level);
+    memcpy(buf, &f, sizeof(f));
+    break;
+  }
+}
+
+
+
+#ifdef HAVE_SSE2
+/* Four sums of samples times taps to four output samples, as InterpTaps     */
+/* does them.  packs does the clipping.  volv is INTERPVOL: for bytes it is  */
+/* the volume times 4 in each word, so that mulhi (which takes the top 16    */
+/* bits) leaves the >> 14.  For the wider formats it is the volume in each   */
+/* dword, and a madd of y widened to dwords gives the whole levels.          */
+void InterpStore4(__m128i y, __m128i volv, int format, uint8* buf)
+{
+  uint32 w;
+
+  y = _mm_srai_epi32(y, INTERP_SHIFT);
+  y = _mm_packs_epi32(y, y);
+  if (format == MOD_OUT_UINT8)
+  {
+    y = _mm_mulhi_epu16(_mm_xor_si128(y, _mm_set1_epi16((short) 0x8000)),
+                        volv);
+    w = (uint32) _mm_cvtsi128_si32(_mm_packus_epi16(y, y));
+    memcpy(buf, &w, sizeof(w));
+    return;
+  }
+
+  y = _mm_madd_epi16(_mm_unpacklo_epi16(y, _mm_setzero_si128()), volv);
+  if (format == MOD_OUT_INT16)
+  {
+    y = _mm_srai_epi32(y, 6);
+    _mm_storel_epi64((__m128i*) buf, _mm_packs_epi32(y, y));
+  }
+  else
+    _mm_storeu_ps((float*) buf, _mm_mul_ps(_mm_cvtepi32_ps(y),
+                                           _mm_set1_ps(1.0f / (1 << 21))));
+}
+
+
+
+/* The two int16s at p in the low dword                                      */
+__m128i InterpPair(const int16* p)
+{
+  int w;
+
+  memcpy(&w, p, sizeof(w));
+  return(_mm_cvtsi32_si128(w));
+}
+#endif
+
+
+
+/* Linear: four samples at a time.  The pairs of samples are gathered and    */
+/* weighted by the phases of the four positions, which are worked out        */
+/* alongside rather than looked up: the table's taps are just 1 - f and f.   */
+/* Only the fractions are kept for that, and they can wrap as they please.   */
+void InterpLinear(const int16* s, const int16* table, uint64 pos, uint64 inc,
+                  uint32 length, uint8 vol, int format, uint8* buf)
+{
+#ifdef HAVE_SSE2
+  __m128i volv = INTERPVOL(format, vol);
+  uint32 step = 4 * OUTSIZE(format);
+  __m128i p4 = _mm_set_epi32((int) (pos + 3 * inc), (int) (pos + 2 * inc),
+                             (int) (pos + inc), (int) pos);
+  __m128i inc4 = _mm_set1_epi32((int) (inc << 2));
+  __m128i x, y, f;
+
+  for (; length >= 4; length -= 4, buf += step, pos += inc << 2)
+  {
+    x = _mm_unpacklo_epi32(InterpPair(s + POSINDEX(pos)),
+                           InterpPair(s + POSINDEX(pos + inc)));
+    y = _mm_unpacklo_epi32(InterpPair(s + POSINDEX(pos + 2 * inc)),
+                           InterpPair(s + POSINDEX(pos + 3 * inc)));
+    x = _mm_unpacklo_epi64(x, y);
+
+    /* The taps are 1 - f and f (INTERP_SHIFT b.p.) in the two halves        */
+    f = _mm_srli_epi32(p4, POS_SHIFT - INTERP_PHASE_BITS);
+    f = _mm_slli_epi32(f, INTERP_SHIFT - INTERP_PHASE_BITS);
+    f = _mm_or_si128(_mm_sub_epi32(_mm_set1_epi32(1 << INTERP_SHIFT), f),
+                     _mm_slli_epi32(f, 16));
+    InterpStore4(_mm_madd_epi16(x, f), volv, format, buf);
+    p4 = _mm_add_epi32(p4, inc4);
+  }
+#endif
+  InterpTaps(s, table, 2, pos, inc, length, vol, format, buf);
+}
+
+
+
+#ifdef HAVE_SSE2
+/* The four taps of the samples at p and q in one madd: the two sums are     */
+/* left in dwords 0 + 1 and 2 + 3                                            */
+__m128i InterpCubic2(const int16* s, const int16* table, uint64 p, uint64 q)
+{
+  const __m128i* x = (const __m128i*) (s + POSINDEX(p) - 1);
+  const __m128i* y = (const __m128i*) (s + POSINDEX(q) - 1);
+
+  return(_mm_madd_epi16(
+    _mm_unpacklo_epi64(_mm_loadl_epi64(x), _mm_loadl_epi64(y)),
+    _mm_unpacklo_epi64(
+      _mm_loadl_epi64((const __m128i*) (table + INTERPPHASE(p) * 4)),
+      _mm_loadl_epi64((const __m128i*) (table + INTERPPHASE(q) * 4)))));
+}
+#endif
+
+
+
+/* Cubic: four samples at a time in two madds                                */
+void InterpCubic(const int16* s, const int16* table, uint64 pos, uint64 inc,
+                 uint32 length, uint8 vol, int format, uint8* buf)
+{
+#ifdef HAVE_SSE2
+  __m128i volv = INTERPVOL(format, vol);
+  __m128i a, b;
+  uint64 p1, p2, p3;
+  uint32 step = 4 * OUTSIZE(format);
+
+  for (; length >= 4; length -= 4, buf += step, pos = p3 + inc)
+  {
+    p1 = pos + inc;
+    p2 = p1 + inc;
+    p3 = p2 + inc;
+    a = _mm_shuffle_epi32(InterpCubic2(s, table, pos, p1),
+                          _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shuffle_epi32(InterpCubic2(s, table, p2, p3),
+                          _MM_SHUFFLE(3, 1, 2, 0));
+    InterpStore4(_mm_add_epi32(_mm_unpacklo_epi64(a, b),
+                               _mm_unpackhi_epi64(a, b)), volv, format, buf);
+  }
+#endif
+  InterpTaps(s, table, 4, pos, inc, length, vol, format, buf);
+}
+
+
+
+#ifdef HAVE_SSE2
+/* The sixteen taps of the sample at p in two madds, as four part sums       */
+__m128i InterpSinc1(const int16* s, const int16* table, uint64 p)
+{
+  const __m128i* x = (const __m128i*)
+    (s + POSINDEX(p) - (INTERP_SINC_TAPS / 2 - 1));
+  const __m128i* c = (const __m128i*)
+    (table + INTERPPHASE(p) * INTERP_SINC_TAPS);
+
+  return(_mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128(x), _mm_loadu_si128(c)),
+                       _mm_madd_epi16(_mm_loadu_si128(x + 1),
+                                      _mm_loadu_si128(c + 1))));
+}
+#endif
+
+
+
+/* Windowed sinc: each sample is two madds; four samples' part sums are      */
+/* then added across together                                                */
+void InterpSinc(const int16* s, const int16* table, uint64 pos, uint64 inc,
+                uint32 length, uint8 vol, int format, uint8* buf)
+{
+#ifdef HAVE_SSE2
+  __m128i volv = INTERPVOL(format, vol);
+  __m128i a, b, c, d;
+  uint64 p1, p2, p3;
+  uint32 step = 4 * OUTSIZE(format);
+
+  for (; length >= 4; length -= 4, buf += step, pos = p3 + inc)
+  {
+    p1 = pos + inc;
+    p2 = p1 + inc;
+    p3 = p2 + inc;
+    a = InterpSinc1(s, table, pos);
+    b = InterpSinc1(s, table, p1);
+    c = InterpSinc1(s, table, p2);
+    d = InterpSinc1(s, table, p3);
+    a = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+    c = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+    InterpStore4(_mm_add_epi32(_mm_unpacklo_epi64(a, c),
+                               _mm_unpackhi_epi64(a, c)), volv, format, buf);
+  }
+#endif
+  InterpTaps(s, table, INTERP_SINC_TAPS, pos, inc, length, vol, format, buf);
+}
+
+
+
+/* Starts the row at song_pos/division by doing its effects.  A row with     */
+/* a bad effect is still played; the bad effect is left out and the error    */
+/* is returned.                                                              */
+MPstatus StartRow(MPplayer* pl, const struct mod_row** ret_row)
+{
+  const struct mod_data* mod = pl->mod;
+
+  pl->pattern = mod->pattern_slot[mod->pattern_table[pl->song_pos]];
+  *ret_row = MODROW(mod, pl->pattern, pl->division);
+  if (pl->prefetch_rows)
+    ModPrefetchRows(pl->module, pl->song_pos,
+                    pl->division + pl->prefetch_rows, 1);
+  return(ProcessRow(pl, *ret_row));
+}
+
+
+
+/* Moves song_pos/division on from the row that has just been played (see    */
+/* ModNextRow).  A pattern loop going back forgets that the rows it goes     */
+/* back over were played, so that playing them again isn't taken for the     */
+/* song looping, and gives 1.                                                */
+int NextRow(MPplayer* pl, const struct mod_row* row)
+{
+  uint8 from = pl->division;
+
+  if (!ModNextRow(row, &pl->song_pos, &pl->division, &pl->loop))
+    return(0);
+  ForgetRows(pl->played, pl->song_pos, pl->division, from);
+  return(1);
+}
+
+
+
+/* Clears the bits of divisions from to to (inclusive) of order song_pos     */
+void ForgetRows(uint8* bits, uint32 song_pos, uint32 from, uint32 to)
+{
+  uint32 n;
+
+  for (n = song_pos * MOD_NUM_DIVISIONS + from;
+       n <= song_pos * MOD_NUM_DIVISIONS + to; n++)
+    bits[n >> 3] &= ~(1 << (n & 7));
+}
+
+
+
+/* Plays the song from where the player is (the start, unless it has been    */
+/* seeked) to the end, or until it loops (see PlayerSetLoop).  Any bad       */
+/* effects that were left out are returned.                                  */
+MPstatus PlayerRun(MPplayer* pl)
+{
+  const struct mod_row* row;
+  MPstatus status = MP_OK;
+
+  ModPrefetchRows(pl->module, pl->song_pos, pl->division, pl->prefetch_rows);
+  while (pl->song_pos < pl->mod->length)
+  {
+/*  printf("Pos:%3d   Pat:%3d   TPD:%3d   Div:%3d\r",
+            pl->song_pos, pl->pattern, pl->tpd, pl->division); */
+    fflush(NULL);
+
+    if ((row = pl->started_row))
+      pl->started_row = NULL;
+    else
+    {
+      if (LoopCheck(pl))
+        break;
+      status |= StartRow(pl, &row);
+    }
+    PlayDivision(pl, 0);
+    if (pl->ended)
+      break;
+    NextRow(pl, row);
+  }
+  return(status);
+}
+
+
+
+/* Notes that the row at song_pos/division is about to be played, and says   */
+/* whether the player should stop there instead (see PlayerSetLoop)          */
+int LoopCheck(MPplayer* pl)
+{
+  uint32 n = pl->song_pos * MOD_NUM_DIVISIONS + pl->division;
+
+  if (pl->ended)
+    return(1);
+  if (!(pl->played[n >> 3] & (1 << (n & 7))) || pl->fade_left)
+  {
+    pl->played[n >> 3] |= 1 << (n & 7);
+    return(0);
+  }
+
+  /* The song has looped.  Start looking for the next loop from here.        */
+  memset(pl->played, 0, sizeof(pl->played));
+  pl->played[n >> 3] |= 1 << (n & 7);
+  if (pl->loops_left)
+  {
+    if (pl->loops_left != MOD_LOOP_FOREVER)
+      pl->loops_left--;
+    return(0);
+  }
+  if (pl->fade_length)
+  {
+    pl->fade_left = pl->fade_length;
+    return(0);
+  }
+  pl->ended = 1;
+  return(1);
+}
+
+
+
+/* After a seek to one of the index's snapshots the rows played are the      */
+/* ones the index saw before it, and there have been no loops.  In a         */
+/* pattern loop that has gone back, the rows from here on haven't been       */
+/* played this time round.                                                   */
+void MarkPlayed(MPplayer* pl)
+{
+  uint32 n;
+
+  memset(pl->played, 0, sizeof(pl->played));
+  for (n = 0; n < pl->mod->length * MOD_NUM_DIVISIONS; n++)
+    if (pl->seek_row_pos[n] < pl->sample_pos)
+      pl->played[n >> 3] |= 1 << (n & 7);
+  if (pl->loop.left)
+    ForgetRows(pl->played, pl->song_pos, pl->division,
+               MOD_NUM_DIVISIONS - 1);
+  pl->loops_left = pl->loops;
+  pl->fade_left = 0;
+  pl->ended = 0;
+}
+
+
+
+void SaveSnapshot(const MPplayer* pl, struct player_snap* snap)
+{
+  snap->sample_pos = pl->sample_pos;
+  snap->tick_buf_size = pl->tick_buf_size;
+  snap->loop = pl->loop;
+  snap->fx_active = pl->fx_active;
+  snap->song_pos = pl->song_pos;
+  snap->division = pl->division;
+  snap->tpd = pl->tpd;
+  snap->led = (uint8) pl->led;
+  memcpy(snap->chan, pl->chan_state,
+         2 * pl->mod->number_channels * sizeof(struct chan_data));
+}
+
+
+
+void LoadSnapshot(MPplayer* pl, const struct player_snap* snap)
+{
+  pl->sample_pos = snap->sample_pos;
+  pl->tick_buf_size = snap->tick_buf_size;
+  pl->loop = snap->loop;
+  pl->fx_active = snap->fx_active;
+  pl->song_pos = snap->song_pos;
+  pl->division = snap->division;
+  pl->tpd = snap->tpd;
+  pl->led = snap->led;
+  pl->skip_samples = 0;
+  pl->started_row = NULL;
+  memcpy(pl->chan_state, snap->chan,
+         2 * pl->mod->number_channels * sizeof(struct chan_data));
+}
+
+
+
+/* The pre-pass for seeking.  It steps through the song without making any   */
+/* sound, taking a snapshot of the player at the start of every order        */
+/* position (rows = 0) or every rows rows, and noting the sample at which    */
+/* each row is first played.  It stops at the end of the song or when the    */
+/* song gets back to a row it has already played (other than by a pattern    */
+/* loop).  The player is left at the start.                                  */
+MPstatus PlayerBuildSeekIndex(MPplayer* pl, int rows)
+{
+  const struct mod_row* row;
+  struct player_snap* snaps;
+  uint32 n, max_snaps = 0;
+  int since = 0;
+  uint8 last_pos = 0;
+
+  free(pl->seek_snap);
+  pl->seek_snap = NULL;
+  pl->seek_count = 0;
+  if (!pl->seek_row_pos && !(pl->seek_row_pos = (uint32*)
+      malloc(MOD_PATTERN_TABLE_SIZE * MOD_NUM_DIVISIONS * sizeof(uint32))))
+    return(MP_NOMEM);
+  for (n = 0; n < MOD_PATTERN_TABLE_SIZE * MOD_NUM_DIVISIONS; n++)
+    pl->seek_row_pos[n] = MOD_NOT_PLAYED;
+
+  ResetPlayer(pl);
+  while (pl->song_pos < pl->mod->length)
+  {
+    n = pl->song_pos * MOD_NUM_DIVISIONS + pl->division;
+    if (pl->played[n >> 3] & (1 << (n & 7)))
+      break;  /* the song has looped */
+    pl->played[n >> 3] |= 1 << (n & 7);
+    if (pl->seek_row_pos[n] == MOD_NOT_PLAYED)
+      pl->seek_row_pos[n] = pl->sample_pos;
+
+    if (!pl->seek_count || (rows ? since >= rows : pl->song_pos != last_pos))
+    {
+      if (pl->seek_count == max_snaps)
+      {
+        max_snaps = max_snaps ? max_snaps << 1 : 64;
+        if (!(snaps = (struct player_snap*)
+              realloc(pl->seek_snap, max_snaps * pl->seek_snap_size)))
+        {
+          free(pl->seek_snap);
+          free(pl->seek_row_pos);
+          pl->seek_snap = NULL;
+          pl->seek_row_pos = NULL;
+          pl->seek_count = 0;
+          ResetPlayer(pl);
+          return(MP_NOMEM);
+        }
+        pl->seek_snap = snaps;
+      }
+      SaveSnapshot(pl, SNAPAT(pl, pl->seek_count));
+      pl->seek_count++;
+      last_pos = pl->song_pos;
+      since = 0;
+    }
+
+    StartRow(pl, &row);
+    PlayDivision(pl, 1);
+    NextRow(pl, row);
+    since++;
+  }
+
+  ResetPlayer(pl);
+  return(MP_OK);
+}
+
+
+
+/* Steps the player on without making any sound until the start of           */
+/* target_row (order * 64 + division), or until sample if target_row is      */
+/* MOD_NOT_PLAYED.  A sample in the middle of a row leaves that row started  */
+/* with the samples before it still to skip.  The song loops (or stops) as   */
+/* it would playing.                                                         */
+MPstatus StepTo(MPplayer* pl, uint32 sample, uint32 target_row)
+{
+  const struct mod_row* row;
+  uint8 visited[MOD_PATTERN_TABLE_SIZE * MOD_NUM_DIVISIONS / 8];
+  uint32 n = MOD_NOT_PLAYED;
+  uint8 from;
+
+  memset(visited, 0, sizeof(visited));
+  while (pl->song_pos < pl->mod->length)
+  {
+    if (target_row != MOD_NOT_PLAYED)
+    {
+      /* Going round a loop without finding it means it is never played      */
+      n = pl->song_pos * MOD_NUM_DIVISIONS + pl->division;
+      if (n == target_row || (visited[n >> 3] & (1 << (n & 7))))
+        break;
+      visited[n >> 3] |= 1 << (n & 7);
+    }
+    else if (pl->sample_pos >= sample)
+      break;
+
+    if (LoopCheck(pl))
+      break;
+    StartRow(pl, &row);
+    if (target_row == MOD_NOT_PLAYED &&
+        pl->sample_pos + pl->row_ticks * pl->tick_buf_size > sample)
+    {
+      /* PlayerRun will play the rest of it                                  */
+      pl->started_row = row;
+      pl->skip_samples = sample - pl->sample_pos;
+      break;
+    }
+    PlayDivision(pl, 1);
+    if (pl->ended)
+      break;
+    from = pl->division;
+    if (NextRow(pl, row))
+      ForgetRows(visited, pl->song_pos, pl->division, from);
+  }
+
+  if (pl->song_pos >= pl->mod->length || pl->ended ||
+      (target_row != MOD_NOT_PLAYED && n != target_row))
+    return(MP_BADARGS);
+  return(MP_OK);
+}
+
+
+
+/* Makes the next PlayerRun start at sample (counted from the start of the   */
+/* song at the player's rate).  With a seek index it starts from the last    */
+/* snapshot before sample, otherwise from the start of the song.  Gives      */
+/* MP_BADARGS if the song ends first.                                        */
+MPstatus PlayerSeekSample(MPplayer* pl, uint32 sample)
+{
+  uint32 lo = 0, hi = pl->seek_count, mid;
+
+  /* The snapshots are in the order they were taken, i.e. by sample_pos      */
+  while (hi - lo > 1)
+  {
+    mid = (lo + hi) >> 1;
+    if (SNAPAT(pl, mid)->sample_pos <= sample)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  if (pl->seek_count)
+  {
+    LoadSnapshot(pl, SNAPAT(pl, lo));
+    MarkPlayed(pl);
+  }
+  else
+    ResetPlayer(pl);
+  return(StepTo(pl, sample, MOD_NOT_PLAYED));
+}
+
+
+
+/* Makes the next PlayerRun start at the first time the song plays           */
+/* division of order song_pos.  Gives MP_BADARGS if it never does.           */
+MPstatus PlayerSeek(MPplayer* pl, int song_pos, int division)
+{
+  uint32 n;
+
+  if (song_pos < 0 || song_pos >= pl->mod->length ||
+      division < 0 || division >= MOD_NUM_DIVISIONS)
+    return(MP_BADARGS);
+  n = song_pos * MOD_NUM_DIVISIONS + division;
+
+  if (pl->seek_row_pos)
+  {
+    if (pl->seek_row_pos[n] == MOD_NOT_PLAYED)
+      return(MP_BADARGS);
+    return(PlayerSeekSample(pl, pl->seek_row_pos[n]));
+  }
+  ResetPlayer(pl);
+  return(StepTo(pl, MOD_NOT_PLAYED, n));
+}
+
+
+
+/* Presumes that the MOD file has been loaded and the mixer initialized with */
+/* the correct number of channels, and an arbitrary resolution and rate.     */
+/* The player's output is made in the mixer's resolution.  The module is     */
+/* only read, so it may be shared with other players.                        */
+MPstatus PlayMod(const MPmodule* module)
+{
+  MPplayer* pl;
+  MPstatus status;
+
+  if ((status = PlayerCreate(module, MixerGetRate(), &pl)) != MP_OK)
+    return(status);
+  PlayerSetOutput(pl, MixerGetResolution());
+  status = PlayerRun(pl);
+  PlayerFree(pl);
+  return(status);
+}
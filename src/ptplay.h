@@ -12,12 +12,8 @@
 #define ptplay_h
 
 #include "mod.h"
+#include "loadmod.h"
 
-/* This is the maximum number of samples that may be needed to process one   */
-/* tick.  i.e. assume highest freq (44100Hz), smallest bpm (33 or 32         */
-/* depending on which MOD specification you read... I like the 32)           */
-/* seconds per tick = 2.5/32 so max buf size is 3445.3125                    */
-#define MAX_TICK_BUFFER_SIZE 3446
 #define AMIGA_CLOCK 7093789         /* This is the PAL (!NTSC) clock speed  */
 /* #define AMIGA_CLOCK 7159091  NTSC clock speed */
 /* #define AMIGA_CLOCK 10541918 */
@@ -33,6 +29,75 @@
 /* representd period 856 and based on the above AMIGA_CLOCK rate.  It's not  */
 /* currently used.                                                           */
 
-MPstatus PlayMod(void);
+#define MOD_DEFAULT_SPEED 6         /* ticks per division at the start      */
+#define MOD_DEFAULT_TEMPO 125       /* and beats per minute                 */
+#define MOD_MIN_TEMPO 32            /* the slowest an Fxx can set           */
+#define MODTICKSIZE(rate, bpm) ((5 * (rate)) / ((bpm) << 1))
+/* The number of output samples in a tick at rate and bpm.  Everything that */
+/* times a song (the player, ptflow.c) must use this to agree to a sample.  */
+
+#define MOD_LOOP_FOREVER -1         /* for PlayerSetLoop                    */
+
+#define MOD_PERIOD_LIMIT 4096
+/* Periods are 12 bits in a pattern so the player's period to increment      */
+/* table has this many entries (built once for each player's output rate).   */
+#define MOD_NUM_NOTES 36            /* C-1 to B-3                           */
+#define MOD_NUM_FINETUNES 16        /* 0 to 7 then -8 to -1                 */
+
+/* The resampling kernels for PlayerSetInterpolation                         */
+#define MOD_INTERP_NEAREST 0        /* the sample at or before the point    */
+#define MOD_INTERP_LINEAR 1         /* a straight line between two samples  */
+#define MOD_INTERP_CUBIC 2          /* a cubic Hermite curve through four   */
+#define MOD_INTERP_SINC 3           /* 16 taps of a windowed sinc           */
+#define MOD_INTERP_PAULA 4          /* Paula's steps, band-limited          */
+#define MOD_INTERP_KERNELS 5
+
+/* The Amiga output filters Paula mode can play through (PlayerSetFilter)    */
+#define MOD_FILTER_NONE 0
+#define MOD_FILTER_A500 1           /* 4.4 kHz low pass, 5 Hz high pass     */
+#define MOD_FILTER_A1200 2          /* 34 kHz low pass, 5 Hz high pass      */
+
+/* The formats a player's output can be in (PlayerSetOutput).  They are      */
+/* the sizes in bits, as are the mixer's resolutions (see mixer.h).          */
+#define MOD_OUT_UINT8 8             /* unsigned, times the volume / 64      */
+#define MOD_OUT_INT16 16            /* signed, full scale at 32768          */
+#define MOD_OUT_FLOAT 32            /* -1.0 to 1.0                          */
+
+/* One playing of one song.  Each player keeps all of its own state, so      */
+/* several may play (the same or different modules) at once in different     */
+/* threads.  The one mixer (mixer.h) is the default sink, so players that    */
+/* run at the same time need their own sinks.                                */
+typedef struct player MPplayer;
+
+/* A sink takes the output of one channel for one tick: length samples at    */
+/* *samples, in the player's output format.  The arguments are those of Mix. */
+/* *samples is NULL for a tick of silence, which the player doesn't make.    */
+/* The same type takes each channel on its own (see PlayerSetStems).         */
+typedef int (*MPsink)(void* sink_data, int channel_id, void** samples,
+                      int length);
+
+MPstatus PlayerCreate(const MPmodule* module, int out_rate,
+                      MPplayer** ret_player);
+void     PlayerSetSink(MPplayer* player, MPsink sink, void* sink_data);
+void     PlayerSetStems(MPplayer* player, MPsink sink, void* sink_data);
+MPstatus PlayerSetOutput(MPplayer* player, int format);
+void     PlayerSetPrefetch(MPplayer* player, int rows);
+void     PlayerSetEffectBlock(MPplayer* player, int samples);
+MPstatus PlayerSetRamp(MPplayer* player, int samples);
+void     PlayerSetLoop(MPplayer* player, int loops, int fade_ms);
+MPstatus PlayerSetInterpolation(MPplayer* player, int kernel);
+MPstatus PlayerSetFilter(MPplayer* player, int model);
+MPstatus PlayerRun(MPplayer* player);
+
+/* Seeking.  PlayerBuildSeekIndex is optional: it takes snapshots (every     */
+/* order position for rows = 0, else every rows rows) so that a seek only    */
+/* has to step on from the nearest one rather than from the start.           */
+MPstatus PlayerBuildSeekIndex(MPplayer* player, int rows);
+MPstatus PlayerSeek(MPplayer* player, int song_pos, int division);
+MPstatus PlayerSeekSample(MPplayer* player, uint32 sample);
+void     PlayerFree(MPplayer* player);
+
+/* PlayMod plays the song once through the mixer, at the mixer's rate.       */
+MPstatus PlayMod(const MPmodule* module);
 
 #endif